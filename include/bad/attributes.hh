@@ -408,6 +408,10 @@
 /// The user should explicitly throw away the result rather than let it be silently discarded
 #define bad_nodiscard [[nodiscard]]
 
+/// \def bad_noreturn
+/// \brief C++11 `[[noreturn]]`. The function never returns to its caller
+#define bad_noreturn [[noreturn]]
+
 /// \}
 //
 #endif
@@ -6,8 +6,14 @@
 #include <limits>
 #include <type_traits>
 #include <cstdlib>
+#include <exception>
 #include <memory>
 
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#define BAD_HAS_MMAP 1
+#endif
+
 /// \file
 /// \brief memory api
 /// \author Edward Kmett
@@ -20,6 +26,10 @@ namespace bad::memory {
   static constexpr size_t record_alignment = 16;
   /// \ingroup memory_group
   static constexpr size_t record_mask = static_cast<size_t>(~0xf);
+  /// \ingroup memory_group
+  static constexpr size_t cache_line_size = 64;
+  /// \ingroup memory_group
+  static constexpr size_t huge_page_size = size_t(2) << 20;
 
   /// \ingroup memory_group
   BAD(hd,inline,const)
@@ -28,6 +38,16 @@ namespace bad::memory {
     return !(iptr % alignment);
   }
 
+  /// \brief what the allocators here do when the system won't give them memory.
+  ///
+  /// They are all `noexcept` and promise a non-null result, so rather than hand back a pointer to nothing
+  /// they end the process through `std::terminate`, just as a `std::bad_alloc` escaping them would.
+  /// \ingroup memory_group
+  BAD(noreturn,hd,inline)
+  void allocation_failure() noexcept {
+    std::terminate();
+  }
+
   /// \ingroup memory_group
   template <class T, size_t Alignment = record_alignment>
   struct aligned_allocator {
@@ -41,6 +61,9 @@ namespace bad::memory {
 
     static constexpr size_t alignment = Alignment;
 
+    /// \ref bad::tapes::tape "tapes" drawing slabs from here align their records to this
+    static constexpr size_t record_alignment = Alignment;
+
     template <class U> struct rebind {
       using other = aligned_allocator<T, alignment>;
     };
@@ -56,8 +79,10 @@ namespace bad::memory {
     BAD(nodiscard,hd,inline,malloc,assume_aligned(alignment),returns_nonnull)
     T * allocate(size_t n) const noexcept {
       assert(n < std::numeric_limits<std::size_t>::max() / sizeof(T));
-      T* result = static_cast<T*>(aligned_alloc(alignment,n));
-      assert(result);
+      // aligned_alloc wants a byte count that is a multiple of the alignment
+      size_t bytes = (n * sizeof(T) + alignment - 1) & ~(alignment - 1);
+      T* result = static_cast<T*>(aligned_alloc(alignment,bytes));
+      if (result == nullptr) allocation_failure();
       return result;
     }
 
@@ -92,6 +117,99 @@ namespace bad::memory {
 
   /// \ingroup memory_group
   using default_allocator = aligned_allocator<std::byte, record_alignment>;
+
+#if defined(BAD_HAS_MMAP) || defined(DOXYGEN)
+  /// \brief stateless allocator that maps whole huge pages directly from the kernel.
+  ///
+  /// Tries for explicit `MAP_HUGETLB` pages first. If none are reserved, maps `PageSize` aligned
+  /// anonymous memory and asks for transparent huge pages with `madvise(MADV_HUGEPAGE)`.
+  ///
+  /// Allocations are rounded up to whole pages, so it is only worth using for big blocks.
+  /// `segment_size` tells \ref bad::tapes::tape "tapes" to size their segments to match.
+  /// \ingroup memory_group
+  template <class T = std::byte, size_t PageSize = huge_page_size>
+  struct huge_page_allocator {
+    using pointer = T*;
+    using const_pointer = T const *;
+    using void_pointer = void *;
+    using const_void_pointer = void const *;
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+
+    static_assert((PageSize & (PageSize - 1)) == 0, "page size must be a power of two");
+
+    static constexpr size_t alignment = PageSize;
+    static constexpr size_t segment_size = PageSize;
+
+    template <class U> struct rebind {
+      using other = huge_page_allocator<U, PageSize>;
+    };
+
+    huge_page_allocator() = default;
+
+    template <class U>
+    BAD(hd,inline,noalias)
+    constexpr huge_page_allocator(BAD(noescape) const huge_page_allocator<U,PageSize> &) noexcept {}
+
+    /// bytes actually mapped for `n` elements
+    BAD(hd,inline,const) constexpr
+    static size_t mapped_size(size_t n) noexcept {
+      return (n * sizeof(T) + PageSize - 1) & ~(PageSize - 1);
+    }
+
+    BAD(nodiscard,hd,malloc,assume_aligned(alignment),returns_nonnull)
+    T * allocate(size_t n) const noexcept {
+      assert(n < std::numeric_limits<std::size_t>::max() / sizeof(T));
+      size_t bytes = mapped_size(n);
+#ifdef MAP_HUGETLB
+      if (PageSize == huge_page_size) {
+        void * p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) return static_cast<T*>(p);
+      }
+#endif
+      // over-allocate by a page so we can trim to an aligned window, which lets the kernel use huge pages for all of it
+      void * m = mmap(nullptr, bytes + PageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (m == MAP_FAILED) allocation_failure();
+      std::byte * p = static_cast<std::byte*>(m);
+      std::byte * q = reinterpret_cast<std::byte*>((reinterpret_cast<std::uintptr_t>(p) + PageSize - 1) & ~(PageSize - 1));
+      // both ends lie within our own mapping, on page boundaries, so trimming can only fail if something is badly wrong
+      if (q != p && munmap(p, size_t(q - p)) != 0) allocation_failure();
+      if (size_t tail = PageSize - size_t(q - p); tail != 0 && munmap(q + bytes, tail) != 0) allocation_failure();
+#ifdef MADV_HUGEPAGE
+      // only a hint. it fails harmlessly on kernels without transparent huge pages, leaving us with small pages
+      BAD(maybe_unused) int hinted = madvise(q, bytes, MADV_HUGEPAGE);
+#endif
+      return reinterpret_cast<T*>(q);
+    }
+
+    /// unlike \ref aligned_allocator there is no unsized deallocate. we need to know how much to unmap
+    BAD(hd,inline,noalias)
+    void deallocate(BAD(noescape) T *p, size_t n) noexcept {
+      // only fails if `p` and `n` didn't come from allocate
+      BAD(maybe_unused) int r = munmap(p, mapped_size(n));
+      assert(r == 0);
+    }
+
+    template <class U>
+    BAD(hd,inline,const)
+    friend bool operator ==(
+      BAD(maybe_unused) huge_page_allocator<T,PageSize>,
+      BAD(maybe_unused) huge_page_allocator<U,PageSize>
+    ) noexcept {
+      return true;
+    }
+
+    template <class U>
+    BAD(hd,inline,const)
+    friend bool operator !=(
+      BAD(maybe_unused) huge_page_allocator<T,PageSize>,
+      BAD(maybe_unused) huge_page_allocator<U,PageSize>
+    ) noexcept {
+      return false;
+    }
+  };
+#endif
 }
 
 namespace bad {
@@ -1,7 +1,9 @@
 #ifndef BAD_MIXED_MODE_HH
 #define BAD_MIXED_MODE_HH
 
+#include <tuple>
 #include <type_traits>
+#include <utility>
 
 #include "bad/attributes.hh"
 #include "bad/sequences.hh"
@@ -63,7 +65,7 @@ namespace bad::mixed_mode {
     }
 
     /// compute the product of partials and tangents
-    template <class T, size_t j>
+    template <size_t j, class T>
     BAD(hd,nodiscard,inline,flatten)
     auto tangent(T parts) const noexcept {
       return me().template tangent<j>(parts);
@@ -78,6 +80,23 @@ namespace bad::mixed_mode {
         || args < size;
   }
 
+  namespace detail {
+    /// call `f(std::integral_constant<size_t,i>())` for each `i < n`, in order
+    /// \ingroup mixed_mode_group
+    template <class F, size_t... is>
+    BAD(hd,inline,flatten) constexpr
+    void for_each_index(F && f, std::index_sequence<is...>) noexcept {
+      (f(std::integral_constant<size_t, is>()), ...);
+    }
+
+    /// \ingroup mixed_mode_group
+    template <size_t n, class F>
+    BAD(hd,inline,flatten) constexpr
+    void for_each_index(F && f) noexcept {
+      for_each_index(std::forward<F>(f), std::make_index_sequence<n>());
+    }
+  }
+
   /// \brief mixed-mode value/tangent bundle, classic dual numbers generalized to N infinitesimals.
   /// \ingroup mixed_mode_group
 
@@ -86,7 +105,8 @@ namespace bad::mixed_mode {
 
   template <class T, class... Ds>
   class BAD(empty_bases,nodiscard) mixed<T,std::tuple<Ds...>> final
-  :                     mixed_expr<mixed<T,std::tuple<Ds...>>> {
+  : public              mixed_expr<mixed<T,std::tuple<Ds...>>> {
+  public:
     static constexpr size_t size = sizeof...(Ds);
     static constexpr size_t args = 1;
 
@@ -104,10 +124,16 @@ namespace bad::mixed_mode {
     mixed(T rhs) noexcept : p(rhs), d() {}
 
     BAD(hd,inline) constexpr
-    mixed(mixed const & rhs) : p(rhs.p), d(rhs.d) {}
+    mixed(mixed const & rhs) noexcept = default;
+
+    BAD(hd,inline) constexpr
+    mixed(mixed && rhs) noexcept = default;
+
+    BAD(hd,inline)
+    mixed & operator =(mixed const & rhs) noexcept = default;
 
     BAD(hd,inline)
-    mixed(mixed && rhs) : p(std::move(rhs.p)), d(std::move(rhs.d)) {}
+    mixed & operator =(mixed && rhs) noexcept = default;
 
     template <class B>
     BAD(hd,inline,flatten) constexpr
@@ -116,12 +142,12 @@ namespace bad::mixed_mode {
       using std::get;
       static_assert(std::is_same_v<tangents, typename B::tangents>);
       if constexpr (prefer_forward(B::args,size)) {
-        forN<size> op([&](size_t i) {
+        detail::for_each_index<size>([&](auto i) {
           get<i>(d) = rhs.template dual<i>();
         });
       } else {
         auto parts = rhs.partials(1);
-        forN<size> op([&](size_t i) {
+        detail::for_each_index<size>([&](auto i) {
           get<i>(d) = rhs.template tangent<i>(parts);
         });
       }
@@ -134,12 +160,12 @@ namespace bad::mixed_mode {
       static_assert(std::is_same_v<tangents, typename B::tangents>);
       p = rhs.primal();
       if constexpr (prefer_forward(B::args,size)) {
-        forN<size> op([&](size_t i) {
+        detail::for_each_index<size>([&](auto i) {
           get<i>(d) = rhs.template dual<i>();
         });
       } else {
         auto parts = rhs.partials(1);
-        forN<size> op([&](size_t i) {
+        detail::for_each_index<size>([&](auto i) {
           get<i>(d) = rhs.template tangent<i>(parts);
         });
       }
@@ -153,12 +179,12 @@ namespace bad::mixed_mode {
       static_assert(std::is_same_v<tangents, typename B::tangents>);
       p += rhs.primal();
       if constexpr (prefer_forward(B::args,size)) {
-        forN<size> op([&](size_t i) {
+        detail::for_each_index<size>([&](auto i) {
           get<i>(d) += rhs.template dual<i>();
         });
       } else {
         auto parts = rhs.partials(1);
-        forN<size> op([&](size_t i) {
+        detail::for_each_index<size>([&](auto i) {
           get<i>(d) += rhs.template tangent<i>(parts);
         });
       }
@@ -172,12 +198,12 @@ namespace bad::mixed_mode {
       static_assert(std::is_same_v<tangents, typename B::tangents>);
       p -= rhs.primal();
       if constexpr (prefer_forward(B::args,size)) {
-        forN<size> op([&](size_t i) {
+        detail::for_each_index<size>([&](auto i) {
           get<i>(d) -= rhs.template dual<i>();
         });
       } else {
         auto parts = rhs.partials(1);
-        forN<size> op([&](size_t i) {
+        detail::for_each_index<size>([&](auto i) {
           get<i>(d) -= rhs.template tangent<i>(parts);
         });
       }
@@ -197,7 +223,7 @@ namespace bad::mixed_mode {
     }
 
     BAD(hd,nodiscard,inline) constexpr
-    T partials(T x) noexcept {
+    T partials(T x) const noexcept {
       return x;
     }
 
@@ -453,14 +479,14 @@ namespace bad::mixed_mode {
       using left_type = std::decay_t<L>;
       using right_type = std::decay_t<R>;
 
-      static constexpr size_t size = L::size;
-      static constexpr size_t args = L::args + R::args;
+      static constexpr size_t size = left_type::size;
+      static constexpr size_t args = left_type::args + right_type::args;
 
-      static_assert(std::is_same_v<typename L::tangents,typename R::tangents>,"tangent type mismatch");
+      static_assert(std::is_same_v<typename left_type::tangents,typename right_type::tangents>,"tangent type mismatch");
 
-      using tangents = typename L::tangents;
-      using element_type = decltype(std::declval<L>().primal() + std::declval<R>().primal());
-      using partials_type = std::tuple<typename L::partials_type, typename R::partials_type>;
+      using tangents = typename left_type::tangents;
+      using element_type = decltype(std::declval<left_type>().primal() + std::declval<right_type>().primal());
+      using partials_type = std::tuple<typename left_type::partials_type, typename right_type::partials_type>;
 
       sub_expr<L> lhs;
       sub_expr<R> rhs;
@@ -543,16 +569,16 @@ namespace bad::mixed_mode {
       using left_type = std::decay_t<L>;
       using right_type = std::decay_t<R>;
 
-      static_assert(std::is_same_v<L::tangents,R::tangents>,"tangent type mismatch");
+      static_assert(std::is_same_v<typename left_type::tangents,typename right_type::tangents>,"tangent type mismatch");
 
-      static_assert(L::size == R::size, "tangent size mismatch");
+      static_assert(left_type::size == right_type::size, "tangent size mismatch");
 
-      static constexpr size_t size = L::size;
-      static constexpr size_t args = L::args + R::args;
+      static constexpr size_t size = left_type::size;
+      static constexpr size_t args = left_type::args + right_type::args;
 
-      using tangents = typename L::tangents;
-      using element_type = decltype(std::declval<L>().primal() * std::declval<R>().primal());
-      using partials_type = std::tuple<typename L::partials_type, typename R::partials_type>;
+      using tangents = typename left_type::tangents;
+      using element_type = decltype(std::declval<left_type>().primal() * std::declval<right_type>().primal());
+      using partials_type = std::tuple<typename left_type::partials_type, typename right_type::partials_type>;
 
       sub_expr<L> lhs;
       sub_expr<R> rhs;
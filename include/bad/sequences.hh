@@ -669,7 +669,7 @@ namespace bad::sequences {
     /// \meta
     template <class A, A... as, template <A> class F>
     struct seq_map_<iseq<A,as...>, F> {
-      using type = iseq<decltype(F<declval<A>()>::value), F<as>::value...>;
+      using type = iseq<decltype(F<std::declval<A>()>::value), F<as>::value...>;
     };
   }
 
@@ -688,7 +688,7 @@ namespace bad::sequences {
     /// \meta
     template <class A, A... as, class TT>
     struct seq_map_at_<iseq<A,as...>, TT> {
-      using type = iseq<decltype(TT::template at<declval<A>()>::value), TT::template at<as>::value...>;
+      using type = iseq<decltype(TT::template at<std::declval<A>()>::value), TT::template at<as>::value...>;
     };
   }
 
@@ -707,7 +707,7 @@ namespace bad::sequences {
     /// \meta
     template <class A, class B, A... as, B... bs, template <A,B> class F>
     struct seq_zip_<iseq<A,as...>,iseq<B,bs...>, F> {
-      using type = iseq<decltype(F<declval<A>(),declval<B>()>::value), F<as,bs>::value...>;
+      using type = iseq<decltype(F<std::declval<A>(),std::declval<B>()>::value), F<as,bs>::value...>;
     };
   }
 
@@ -0,0 +1,76 @@
+#ifndef BAD_TAPES_DISPATCH_HH
+#define BAD_TAPES_DISPATCH_HH
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief devirtualized reverse sweeps
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  /// \brief sweep strategy that recognizes the record types `Rs` by tag and calls them directly.
+  ///
+  /// Each record carries a small \ref bad::tapes::detail::record_tag "record_tag". At construction we build
+  /// a table from those tags to positions in `Rs`, and each step of the sweep becomes a table lookup
+  /// followed by a comparison chain against constants, which the compiler lowers to a jump table
+  /// with the bodies of `Rs::prop` inlined into it. Anything else on the tape, including links,
+  /// terminators, and record types not listed here, falls back to the vtable.
+  ///
+  /// ~~~{.cc}
+  /// dispatch<mul,add,scale> d;
+  /// t.backprop(buffer, output, 1, d);
+  /// ~~~
+  /// \ingroup tapes_group
+  template <class... Rs>
+  struct dispatch {
+    static_assert(sizeof...(Rs) < 255, "dispatch: too many record types");
+
+    std::vector<uint8_t> cases; ///< cases[tag] is 1 + the position of the record type in `Rs`, or 0
+
+    BAD(hd)
+    dispatch() noexcept {
+      uint32_t tags[] = { detail::record_tag<Rs>()... };
+      uint32_t top = 0;
+      for (auto t : tags) top = std::max(top, t);
+      cases.assign(top + 1, 0);
+      uint8_t k = 0;
+      for (auto t : tags) cases[t] = ++k;
+    }
+
+    template <class T, class Act, class Allocator>
+    BAD(hd,inline,flatten)
+    abstract_record<T,Act,Allocator> const * operator()(
+      BAD(noescape) abstract_record<T,Act,Allocator> const * p,
+      Act act,
+      BAD(noescape) size_t & i
+    ) const noexcept {
+      uint32_t tag = p->tag;
+      uint8_t k = tag < cases.size() ? cases[tag] : 0;
+      return go(std::index_sequence_for<Rs...>(), k, p, act, i);
+    }
+
+  private:
+    template <size_t... is, class T, class Act, class Allocator>
+    BAD(hd,inline,flatten)
+    static abstract_record<T,Act,Allocator> const * go(
+      std::index_sequence<is...>,
+      uint8_t k,
+      BAD(noescape) abstract_record<T,Act,Allocator> const * p,
+      Act act,
+      BAD(noescape) size_t & i
+    ) noexcept {
+      abstract_record<T,Act,Allocator> const * result = nullptr;
+      // the qualified call to Rs::propagate is not virtual, so each arm inlines prop and next
+      bool hit = ((k == is + 1 && (result = static_cast<Rs const *>(p)->Rs::propagate(act, i), true)) || ...);
+      if (!hit) result = p->propagate(act, i);
+      return result;
+    }
+  };
+}
+
+#endif
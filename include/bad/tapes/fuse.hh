@@ -0,0 +1,236 @@
+#ifndef BAD_TAPES_FUSE_HH
+#define BAD_TAPES_FUSE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/types.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief fusing runs of identical records into batched structure-of-arrays records
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  /// \brief a run of `n` records of type `B`, stored column by column.
+  ///
+  /// Built by \ref fuse. `B` opts in by being a \ref static_record that provides
+  ///
+  /// * `auto fields() const noexcept`, returning a `std::tuple` of its trivially copyable payload, and
+  /// * `static void lane(Act act, size_t i, Fields... fields) noexcept`, the body of its `prop`.
+  ///
+  /// ~~~{.cc}
+  /// struct scale : static_record<1, scale, double> {
+  ///   size_t a;
+  ///   double k;
+  ///   auto fields() const noexcept { return std::make_tuple(a, k); }
+  ///   static void lane(double * act, size_t i, size_t a, double k) noexcept { act[a] += act[i] * k; }
+  ///   void prop(double * act, size_t i) const noexcept { lane(act, i, a, k); }
+  /// };
+  /// ~~~
+  ///
+  /// The header is followed by one array per field. `propagate` walks them in a single loop, running the
+  /// members of the run newest first, just as the sweep would have.
+  /// \ingroup tapes_group
+  template <class B, class T, class Act = T*, class Allocator = default_allocator>
+  struct batch final : abstract_record<T, Act, Allocator> {
+    using abstract_record_type = abstract_record<T, Act, Allocator>;
+    using fields_type = decltype(std::declval<B const &>().fields());
+    static constexpr size_t columns = std::tuple_size_v<fields_type>;
+    static constexpr size_t acts = B::acts;
+
+    template <size_t c>
+    using field = std::tuple_element_t<c, fields_type>;
+
+  private:
+    template <size_t... cs>
+    BAD(hd,const) constexpr
+    static bool trivial_fields(std::index_sequence<cs...>) noexcept {
+      return (std::is_trivially_copyable_v<field<cs>> && ...);
+    }
+
+    // columns are raw bytes in the tape, written with memcpy and never destroyed
+    static_assert(trivial_fields(std::make_index_sequence<columns>()), "fused fields must be trivially copyable");
+
+  public:
+    size_t n; ///< number of fused records
+    size_t bytes; ///< size of the run we replaced, header and columns included
+
+    BAD(hd,noalias)
+    batch(size_t n, size_t bytes) noexcept
+    : abstract_record_type()
+    , n(n)
+    , bytes(bytes) {
+      this->tag = detail::record_tag<batch>();
+    }
+
+    /// byte offset of column `c` from the start of a batch of `n`
+    template <size_t c>
+    BAD(hd,inline,const) constexpr
+    static size_t offset(size_t n) noexcept {
+      size_t end = 0;
+      if constexpr (c == 0) end = sizeof(batch);
+      else end = offset<c - 1>(n) + n * sizeof(field<c - 1>);
+      return (end + alignof(field<c>) - 1) & ~(alignof(field<c>) - 1);
+    }
+
+    /// bytes needed for a batch of `n`
+    BAD(hd,inline,const) constexpr
+    static size_t footprint(size_t n) noexcept {
+      return offset<columns - 1>(n) + n * sizeof(field<columns - 1>);
+    }
+
+    template <size_t c>
+    BAD(hd,inline,pure)
+    field<c> * column() noexcept {
+      return reinterpret_cast<field<c> *>(reinterpret_cast<std::byte *>(this) + offset<c>(n));
+    }
+
+    template <size_t c>
+    BAD(hd,inline,pure)
+    field<c> const * column() const noexcept {
+      return reinterpret_cast<field<c> const *>(reinterpret_cast<std::byte const *>(this) + offset<c>(n));
+    }
+
+    BAD(hd,inline,pure)
+    size_t activations() const noexcept override {
+      return n * acts;
+    }
+
+    BAD(hd,inline,pure,assume_aligned(record_alignment))
+    abstract_record_type const * next() const noexcept override {
+      return reinterpret_cast<abstract_record_type const *>(reinterpret_cast<std::byte const *>(this) + bytes);
+    }
+
+    BAD(hd,inline,pure,assume_aligned(record_alignment))
+    abstract_record_type * next() noexcept override {
+      return reinterpret_cast<abstract_record_type *>(reinterpret_cast<std::byte *>(this) + bytes);
+    }
+
+    BAD(hd)
+    void what(BAD(noescape) std::ostream & os) const noexcept override {
+      os << "batch<" << type_name<B>() << ">[" << n << "]";
+    }
+
+    BAD(hd,inline)
+    void destroy() noexcept override {
+      this->~batch();
+    }
+
+    BAD(hd,flatten,assume_aligned(record_alignment))
+    abstract_record_type const * propagate(Act act, BAD(noescape) size_t & i) const noexcept override {
+      i -= n * acts;
+      run(act, i, std::make_index_sequence<columns>());
+      return next();
+    }
+
+    /// write member `j` of the run, counting from the newest
+    BAD(hd,inline)
+    void set(size_t j, fields_type const & f) noexcept {
+      set(j, f, std::make_index_sequence<columns>());
+    }
+
+  private:
+    template <size_t... cs>
+    BAD(hd,inline,flatten)
+    void run(Act act, size_t i, std::index_sequence<cs...>) const noexcept {
+      std::tuple<field<cs> const *...> cols { column<cs>()... };
+      size_t k = i + n * acts;
+      for (size_t j = 0; j < n; ++j) {
+        k -= acts;
+        B::lane(act, k, std::get<cs>(cols)[j]...);
+      }
+    }
+
+    template <size_t... cs>
+    BAD(hd,inline)
+    void set(size_t j, fields_type const & f, std::index_sequence<cs...>) noexcept {
+      (std::memcpy(column<cs>() + j, &std::get<cs>(f), sizeof(field<cs>)), ...);
+    }
+  };
+
+  namespace detail {
+    /// fuse the `k` records of type `B` starting at `p` into a \ref batch, if it fits
+    /// \ingroup tapes_group
+    template <class B, class T, class Act, class Allocator>
+    BAD(hd)
+    bool fuse_run(abstract_record<T, Act, Allocator> * p, size_t k) noexcept {
+      using batch_type = batch<B, T, Act, Allocator>;
+      constexpr size_t stride = pad_to_alignment<abstract_record<T, Act, Allocator>::alignment>(sizeof(B));
+      size_t bytes = k * stride;
+      if (batch_type::footprint(k) > bytes) return false;
+      std::vector<typename batch_type::fields_type> fields;
+      fields.reserve(k);
+      auto q = reinterpret_cast<std::byte *>(p);
+      for (size_t j = 0; j < k; ++j) {
+        auto r = reinterpret_cast<abstract_record<T, Act, Allocator> *>(q + j * stride);
+        fields.push_back(static_cast<B *>(r)->fields());
+        r->destroy();
+      }
+      // the run's memory is ours now, so bypass the bump allocator
+      auto b = ::new (static_cast<void *>(p)) batch_type(k, bytes);
+      for (size_t j = 0; j < k; ++j) b->set(j, fields[j]);
+      return true;
+    }
+
+    template <class T, class Act, class Allocator, class... Rs>
+    BAD(hd)
+    bool fuse_any(uint32_t tag, abstract_record<T, Act, Allocator> * p, size_t k) noexcept {
+      return ((tag == record_tag<Rs>() && fuse_run<Rs>(p, k)) || ...);
+    }
+  }
+
+  /// \brief rewrite every run of at least `min_run` consecutive records of one of the types `Rs` into a
+  /// single \ref batch, in place. Returns the number of records that were fused.
+  ///
+  /// Each `Rs` must provide `fields` and `lane`, as described for \ref batch. Runs never cross a segment
+  /// boundary or the top of a spliced section. The tape sweeps to the same result afterwards, with one
+  /// virtual call per run rather than one per record. \ref bad::tapes::tape::mark "Marks" taken inside a
+  /// fused run are no longer valid, and batches don't declare their \ref bad::tapes::abstract_record::inputs "inputs".
+  /// \ingroup tapes_group
+  template <class... Rs, class T, class Act, class Allocator>
+  BAD(hd)
+  size_t fuse(BAD(noescape) tape<T, Act, Allocator> & t, size_t min_run = 2) noexcept {
+    static_assert(sizeof...(Rs) > 0, "fuse: nothing to fuse");
+    static_assert((std::is_base_of_v<abstract_record<T, Act, Allocator>, Rs> && ...), "fuse: only records can be fused");
+    using abstract_record_type = abstract_record<T, Act, Allocator>;
+    uint32_t tags[] = { detail::record_tag<Rs>()... };
+    auto fusable = [&](uint32_t tag) {
+      for (auto x : tags) if (x == tag) return true;
+      return false;
+    };
+    auto is_top = [&](abstract_record_type const * p) {
+      for (auto & s : t.sections) if (s.top == p) return true;
+      return false;
+    };
+    size_t fused = 0;
+    for (auto s = t.segment.memory ? &t.segment : nullptr; s != nullptr; s = s->next_segment()) {
+      abstract_record_type * b = s->boundary();
+      for (abstract_record_type * p = s->current; p != b;) {
+        uint32_t tag = p->tag;
+        if (!fusable(tag)) {
+          p = p->next();
+          continue;
+        }
+        abstract_record_type * q = p->next();
+        size_t k = 1;
+        while (q != b && q->tag == tag && !is_top(q)) {
+          q = q->next();
+          ++k;
+        }
+        if (k >= min_run && detail::fuse_any<T, Act, Allocator, Rs...>(tag, p, k)) fused += k;
+        p = q;
+      }
+    }
+    return fused;
+  }
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef BAD_TAPES_HVP_HH
+#define BAD_TAPES_HVP_HH
+
+#include <cstddef>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/mixed_mode.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief Hessian-vector products by forward-over-reverse, with \ref bad::mixed_mode::mixed "mixed" as the tape scalar
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  namespace detail {
+    /// introduces one independent variable on the tape of an \ref bad::tapes::hvp "hvp"
+    /// \ingroup tapes_group
+    template <class T>
+    struct hvp_input final : static_record<1, hvp_input<T>, T> {
+      BAD(hd,inline,const)
+      void prop(BAD(maybe_unused) T *, BAD(maybe_unused) size_t) const noexcept {}
+
+      BAD(hd)
+      bool inputs(size_t, std::vector<size_t> &) const noexcept override {
+        return true;
+      }
+    };
+  }
+
+  /// \brief the gradient of `f` at `x`, and its Hessian times `v`, in one recording and one sweep.
+  ///
+  /// `f(t, xs)` records a scalar function of `x` onto `t`, a `tape<mixed<T>>` whose activations
+  /// `0 .. n-1` already stand for the components of `x`, whose values are in `xs`. It returns the activation
+  /// of its result. Each `xs[j]` carries `v[j]` as its tangent, so every partial `f` computes and saves in
+  /// its records is a dual number holding its derivative in the direction `v`. Sweeping those records with
+  /// dual adjoints gives the gradient in the primal parts and \f$Hv\f$ in the tangents.
+  ///
+  /// Records only have to be written against a generic scalar:
+  ///
+  /// ~~~{.cc}
+  /// template <class T>
+  /// struct mul : static_record<1, mul<T>, T> {
+  ///   size_t a, b;
+  ///   T va, vb;
+  ///   void prop(T * act, size_t i) const noexcept {
+  ///     act[a] += act[i] * vb;
+  ///     act[b] += act[i] * va;
+  ///   }
+  /// };
+  /// ~~~
+  ///
+  /// The cost is one recording in dual arithmetic and one sweep in dual arithmetic, a small constant
+  /// multiple of a gradient, with no finite differencing and no Hessian.
+  /// \ingroup tapes_group
+  template <class T, class F>
+  BAD(hd)
+  void hvp(
+    F && f,
+    BAD(noescape) std::vector<T> const & x,
+    BAD(noescape) std::vector<T> const & v,
+    BAD(noescape) std::vector<T> & gradient,
+    BAD(noescape) std::vector<T> & product
+  ) noexcept {
+    using dual = mixed<T>;
+    assert(x.size() == v.size());
+    size_t n = x.size();
+    tape<dual> t;
+    std::vector<dual> xs(n);
+    for (size_t j = 0; j < n; ++j) {
+      t.template push<detail::hvp_input<dual>>();
+      xs[j] = dual(x[j]);
+      std::get<0>(xs[j].d) = v[j];
+    }
+    size_t output = f(t, static_cast<std::vector<dual> const &>(xs));
+    auto adjoint = t.backprop(output);
+    gradient.resize(n);
+    product.resize(n);
+    for (size_t j = 0; j < n; ++j) {
+      gradient[j] = adjoint[j].primal();
+      product[j] = adjoint[j].template dual<0>();
+    }
+  }
+
+  /// \f$Hv\f$ for the Hessian \f$H\f$ of `f` at `x`, see the overload that also returns the gradient
+  /// \ingroup tapes_group
+  template <class T, class F>
+  BAD(hd,nodiscard)
+  std::vector<T> hvp(
+    F && f,
+    BAD(noescape) std::vector<T> const & x,
+    BAD(noescape) std::vector<T> const & v
+  ) noexcept {
+    std::vector<T> gradient, product;
+    hvp(std::forward<F>(f), x, v, gradient, product);
+    return product;
+  }
+}
+
+#endif
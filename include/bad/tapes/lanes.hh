@@ -0,0 +1,162 @@
+#ifndef BAD_TAPES_LANES_HH
+#define BAD_TAPES_LANES_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief vector mode reverse sweeps, carrying several adjoints per activation
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  namespace detail {
+    /// the largest power of two dividing `bytes`, up to a cache line
+    /// \ingroup tapes_group
+    BAD(hd,inline,const) constexpr
+    size_t lanes_alignment(size_t bytes) noexcept {
+      return std::min(bytes & (~bytes + 1), cache_line_size);
+    }
+  }
+
+  /// \brief `K` adjoints of type `T` side by side, one per seed.
+  ///
+  /// Use `lanes<T,K>*` as the activation type of a tape to propagate `K` seeds in a single sweep. Records
+  /// written against a generic `Act`, like
+  ///
+  /// ~~~{.cc}
+  /// template <class Act>
+  /// struct mul : static_record<1, mul<Act>, double, Act> {
+  ///   size_t a, b;
+  ///   double va, vb;
+  ///   void prop(Act act, size_t i) const noexcept {
+  ///     act[a] += act[i] * vb;
+  ///     act[b] += act[i] * va;
+  ///   }
+  /// };
+  /// ~~~
+  ///
+  /// work unchanged, and each of their updates becomes a fixed-width loop the compiler can vectorize.
+  /// See \ref jacobian.
+  /// \ingroup tapes_group
+  template <class T, size_t K>
+  struct alignas(detail::lanes_alignment(K * sizeof(T))) lanes {
+    static_assert(K > 0, "lanes: need at least one lane");
+    static constexpr size_t width = K;
+
+    T v[K];
+
+    BAD(hd,inline,noalias)
+    lanes() noexcept = default;
+
+    /// every lane set to `x`
+    BAD(hd,inline,noalias) explicit
+    lanes(T x) noexcept {
+      for (size_t k = 0; k < K; ++k) v[k] = x;
+    }
+
+    BAD(hd,inline,pure)
+    T & operator[](size_t k) noexcept { return v[k]; }
+
+    BAD(hd,inline,pure)
+    T const & operator[](size_t k) const noexcept { return v[k]; }
+
+    BAD(hd,inline,noalias)
+    lanes & operator += (BAD(noescape) lanes const & rhs) noexcept {
+      for (size_t k = 0; k < K; ++k) v[k] += rhs.v[k];
+      return *this;
+    }
+
+    BAD(hd,inline,noalias)
+    lanes & operator -= (BAD(noescape) lanes const & rhs) noexcept {
+      for (size_t k = 0; k < K; ++k) v[k] -= rhs.v[k];
+      return *this;
+    }
+
+    BAD(hd,inline,noalias)
+    lanes & operator *= (T x) noexcept {
+      for (size_t k = 0; k < K; ++k) v[k] *= x;
+      return *this;
+    }
+
+    BAD(hd,inline,pure)
+    friend lanes operator + (lanes lhs, BAD(noescape) lanes const & rhs) noexcept { return lhs += rhs; }
+
+    BAD(hd,inline,pure)
+    friend lanes operator - (lanes lhs, BAD(noescape) lanes const & rhs) noexcept { return lhs -= rhs; }
+
+    BAD(hd,inline,pure)
+    friend lanes operator - (lanes x) noexcept { return x *= T(-1); }
+
+    BAD(hd,inline,pure)
+    friend lanes operator * (lanes lhs, T x) noexcept { return lhs *= x; }
+
+    BAD(hd,inline,pure)
+    friend lanes operator * (T x, lanes rhs) noexcept { return rhs *= x; }
+
+    BAD(hd,inline,pure)
+    friend bool operator == (BAD(noescape) lanes const & lhs, BAD(noescape) lanes const & rhs) noexcept {
+      for (size_t k = 0; k < K; ++k) if (lhs.v[k] != rhs.v[k]) return false;
+      return true;
+    }
+
+    BAD(hd,inline,pure)
+    friend bool operator != (BAD(noescape) lanes const & lhs, BAD(noescape) lanes const & rhs) noexcept {
+      return !(lhs == rhs);
+    }
+  };
+
+  /// \brief the rows of the Jacobian of `outputs` with respect to `inputs`, `K` rows per reverse sweep.
+  ///
+  /// Row `r` of the result, stored row-major in `out`, holds the derivative of activation `outputs[r]`
+  /// with respect to each of `inputs`. Takes \f$\lceil m/K \rceil\f$ sweeps for \f$m\f$ outputs. `buffer`
+  /// is reused between sweeps, and between calls if passed back in.
+  /// \ingroup tapes_group
+  template <class T, size_t K, class Allocator, class Dispatch = virtual_dispatch>
+  BAD(hd)
+  void jacobian(
+    BAD(noescape) tape<T, lanes<T, K> *, Allocator> const & t,
+    BAD(noescape) std::vector<size_t> const & outputs,
+    BAD(noescape) std::vector<size_t> const & inputs,
+    BAD(noescape) std::vector<T> & out,
+    BAD(noescape) adjoints<lanes<T, K>> & buffer,
+    BAD(noescape) Dispatch const & step = Dispatch()
+  ) noexcept {
+    size_t m = outputs.size(), n = inputs.size();
+    out.assign(m * n, T(0));
+    for (size_t r = 0; r < m; r += K) {
+      size_t seeds = std::min(K, m - r);
+      buffer.reset(t.activations);
+      for (size_t k = 0; k < seeds; ++k) {
+        assert(outputs[r + k] < t.activations);
+        buffer[outputs[r + k]][k] = T(1);
+      }
+      t.sweep(buffer.data(), step);
+      for (size_t k = 0; k < seeds; ++k)
+        for (size_t j = 0; j < n; ++j)
+          out[(r + k) * n + j] = buffer[inputs[j]][k];
+    }
+  }
+
+  /// \ref jacobian into a freshly allocated matrix
+  /// \ingroup tapes_group
+  template <class T, size_t K, class Allocator, class Dispatch = virtual_dispatch>
+  BAD(hd,nodiscard)
+  std::vector<T> jacobian(
+    BAD(noescape) tape<T, lanes<T, K> *, Allocator> const & t,
+    BAD(noescape) std::vector<size_t> const & outputs,
+    BAD(noescape) std::vector<size_t> const & inputs,
+    BAD(noescape) Dispatch const & step = Dispatch()
+  ) noexcept {
+    std::vector<T> out;
+    adjoints<lanes<T, K>> buffer;
+    jacobian(t, outputs, inputs, out, buffer, step);
+    return out;
+  }
+}
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef BAD_TAPES_PARALLEL_HH
+#define BAD_TAPES_PARALLEL_HH
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief reverse sweeps over independent parts of a tape in parallel
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  /// \brief a fixed set of worker threads, each with its own task deque, that steal from one another when idle.
+  ///
+  /// \ref run hands the same job to every worker, including the calling thread, and returns once all of them
+  /// have finished it. Tasks are plain indices. Jobs use \ref push and \ref pop to share them out, and
+  /// \ref idle to sleep when there is nothing to pop, rather than spinning. Workers sleep between jobs.
+  /// \ingroup tapes_group
+  struct sweep_executor {
+    /// one deque per worker
+    struct queue {
+      std::mutex mutex;
+      std::deque<uint32_t> tasks;
+    };
+
+    BAD(hd)
+    explicit sweep_executor(size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency())) noexcept
+    : queues(std::max<size_t>(1, threads))
+    , generation(0)
+    , pushes(0)
+    , running(0)
+    , stopping(false)
+    , job(nullptr)
+    , context(nullptr) {
+      for (size_t w = 1; w < queues.size(); ++w) workers.emplace_back([this, w] { work(w); });
+    }
+
+    BAD(hd)
+    sweep_executor(sweep_executor const &) = delete;
+
+    BAD(hd)
+    sweep_executor & operator = (sweep_executor const &) = delete;
+
+    BAD(hd)
+    ~sweep_executor() noexcept {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      for (auto & t : workers) t.join();
+    }
+
+    /// number of workers, counting the thread that calls \ref run
+    BAD(hd,pure)
+    size_t size() const noexcept {
+      return queues.size();
+    }
+
+    /// give worker `w` a task, waking an \ref idle worker to steal it
+    BAD(hd)
+    void push(size_t w, uint32_t task) noexcept {
+      {
+        std::lock_guard<std::mutex> lock(queues[w].mutex);
+        queues[w].tasks.push_back(task);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pushes.store(pushes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
+      posted.notify_one();
+    }
+
+    /// how many tasks have been pushed so far. read it before a \ref pop that might fail, to pass to \ref idle
+    BAD(hd)
+    uint64_t pushed() const noexcept {
+      return pushes.load(std::memory_order_acquire);
+    }
+
+    /// sleep until a task is pushed after \ref pushed returned `seen`, or `finished()` holds.
+    /// whatever makes `finished()` true must call \ref release afterwards
+    template <class P>
+    BAD(hd)
+    void idle(uint64_t seen, BAD(noescape) P && finished) noexcept {
+      std::unique_lock<std::mutex> lock(mutex);
+      posted.wait(lock, [&] { return pushes.load(std::memory_order_relaxed) != seen || finished(); });
+    }
+
+    /// wake every \ref idle worker to recheck its condition
+    BAD(hd)
+    void release() noexcept {
+      { std::lock_guard<std::mutex> lock(mutex); }
+      posted.notify_all();
+    }
+
+    /// take the newest task from worker `w`, or failing that steal the oldest from someone else
+    BAD(hd)
+    bool pop(size_t w, BAD(noescape) uint32_t & task) noexcept {
+      {
+        std::lock_guard<std::mutex> lock(queues[w].mutex);
+        if (!queues[w].tasks.empty()) {
+          task = queues[w].tasks.back();
+          queues[w].tasks.pop_back();
+          return true;
+        }
+      }
+      for (size_t k = 1; k < queues.size(); ++k) {
+        auto & victim = queues[(w + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+          task = victim.tasks.front();
+          victim.tasks.pop_front();
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /// run `f(w)` on every worker `w` at once, the caller being worker 0
+    template <class F>
+    BAD(hd)
+    void run(BAD(noescape) F & f) noexcept {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = [](void * c, size_t w) noexcept { (*static_cast<F *>(c))(w); };
+        context = &f;
+        running = workers.size();
+        ++generation;
+      }
+      wake.notify_all();
+      f(size_t(0));
+      std::unique_lock<std::mutex> lock(mutex);
+      done.wait(lock, [this] { return running == 0; });
+    }
+
+  private:
+    BAD(hd)
+    void work(size_t w) noexcept {
+      uint64_t seen = 0;
+      for (;;) {
+        void (*j)(void *, size_t) noexcept;
+        void * c;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          wake.wait(lock, [&] { return stopping || generation != seen; });
+          if (stopping) return;
+          seen = generation;
+          j = job;
+          c = context;
+        }
+        j(c, w);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--running == 0) done.notify_one();
+      }
+    }
+
+    std::vector<queue> queues;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::condition_variable posted; // a task was pushed, or a job finished
+    uint64_t generation;
+    std::atomic<uint64_t> pushes; // only written holding mutex
+    size_t running;
+    bool stopping;
+    void (*job)(void *, size_t) noexcept;
+    void * context;
+  };
+
+  /// \brief a reverse sweep schedule that lets a \ref sweep_executor work on independent parts of a tape at once.
+  ///
+  /// The records of the tape are cut into tasks of `grain` consecutive records in sweep order. A task waits for
+  /// every earlier task that
+  ///
+  /// * adds into one of the activations its records own, or
+  /// * adds into one of the activations its records add into,
+  ///
+  /// as declared by \ref bad::tapes::abstract_record::inputs "abstract_record::inputs". The second rule means
+  /// contributions to any one adjoint still arrive in the same order as in a sequential sweep, so results are
+  /// identical to \ref bad::tapes::tape::sweep "tape::sweep", bit for bit. Records that don't declare their
+  /// inputs wait for everything before them, and everything after them waits for them.
+  ///
+  /// The schedule describes the tape as it was when it was built. Build a new one after pushing more records.
+  /// Spliced sections renumber their activations as the sweep passes them, which can't be done in parallel,
+  /// so a schedule built from a tape with \ref bad::tapes::tape::sections "sections" is empty and refuses to
+  /// sweep. Check \ref schedulable, or the result of \ref backprop, and fall back to a sequential sweep.
+  /// \ingroup tapes_group
+  template <class T, class Act = T*, class Allocator = default_allocator>
+  struct parallel_sweep {
+    using tape_type = tape<T, Act, Allocator>;
+    using abstract_record_type = abstract_record<T, Act, Allocator>;
+    using adjoint_type = typename tape_type::adjoint_type;
+
+    std::vector<abstract_record_type const *> records; ///< in sweep order
+    std::vector<size_t> ends; ///< activations on the tape just after each record was pushed
+    size_t grain; ///< records per task
+    size_t activations; ///< of the tape
+    std::vector<uint32_t> indegree; ///< number of tasks each task waits on
+    std::vector<uint32_t> first; ///< successors of task t are successors[first[t] .. first[t+1])
+    std::vector<uint32_t> successors;
+    bool schedulable; ///< false if the tape had spliced sections, in which case there is nothing to sweep
+
+    BAD(hd)
+    explicit parallel_sweep(BAD(noescape) tape_type const & t, size_t grain = 256) noexcept
+    : grain(std::max<size_t>(grain, 1))
+    , activations(t.activations)
+    , schedulable(t.sections.empty()) {
+      if (!schedulable) return;
+      size_t i = t.activations;
+      for (auto s = t.segment.memory ? &t.segment : nullptr; s != nullptr; s = s->next_segment()) {
+        for (abstract_record_type const * p = s->current, * b = s->boundary(); p != b; p = p->next()) {
+          records.push_back(p);
+          ends.push_back(i);
+          i -= p->activations();
+        }
+      }
+      assert(i == t.base);
+      build();
+    }
+
+    /// number of tasks
+    BAD(hd,pure)
+    size_t tasks() const noexcept {
+      return (records.size() + grain - 1) / grain;
+    }
+
+    /// sweep using every worker of `ex`. returns false, touching nothing, if the tape wasn't \ref schedulable
+    template <class Dispatch = virtual_dispatch>
+    BAD(hd)
+    bool operator()(
+      BAD(noescape) sweep_executor & ex,
+      Act act,
+      BAD(noescape) Dispatch const & step = Dispatch()
+    ) const noexcept {
+      if (!schedulable) return false;
+      size_t n = tasks();
+      if (n == 0) return true;
+      std::unique_ptr<std::atomic<uint32_t>[]> pending(new std::atomic<uint32_t>[n]);
+      for (size_t k = 0; k < n; ++k) pending[k].store(indegree[k], std::memory_order_relaxed);
+      std::atomic<size_t> remaining(n);
+      size_t deal = 0;
+      for (size_t k = 0; k < n; ++k) if (indegree[k] == 0) ex.push(deal++ % ex.size(), uint32_t(k));
+      auto worker = [&](size_t w) noexcept {
+        uint32_t k;
+        while (remaining.load(std::memory_order_acquire) != 0) {
+          uint64_t seen = ex.pushed();
+          if (!ex.pop(w, k)) {
+            ex.idle(seen, [&] { return remaining.load(std::memory_order_acquire) == 0; });
+            continue;
+          }
+          size_t hi = std::min(records.size(), (k + 1) * grain);
+          for (size_t r = k * grain; r < hi; ++r) {
+            size_t i = ends[r];
+            step(records[r], act, i);
+          }
+          for (uint32_t e = first[k]; e < first[k + 1]; ++e) {
+            uint32_t s = successors[e];
+            if (pending[s].fetch_sub(1, std::memory_order_acq_rel) == 1) ex.push(w, s);
+          }
+          if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) ex.release();
+        }
+      };
+      ex.run(worker);
+      return true;
+    }
+
+    /// reset `result` to hold one zeroed adjoint per activation, seed `output`, and sweep in parallel.
+    /// returns false, leaving `result` untouched, if the tape wasn't \ref schedulable
+    template <class Dispatch = virtual_dispatch>
+    BAD(hd,nodiscard)
+    bool backprop(
+      BAD(noescape) sweep_executor & ex,
+      BAD(noescape) adjoints<adjoint_type> & result,
+      size_t output,
+      adjoint_type seed = adjoint_type(1),
+      BAD(noescape) Dispatch const & step = Dispatch()
+    ) const noexcept {
+      static_assert(std::is_pointer_v<Act>, "managed backprop requires a pointer activation type");
+      assert(output < activations);
+      if (!schedulable) return false;
+      result.reset(activations);
+      result[output] = seed;
+      return (*this)(ex, result.data(), step);
+    }
+
+  private:
+    BAD(hd,noalias)
+    void build() noexcept {
+      size_t n = tasks();
+      constexpr uint32_t none = uint32_t(-1);
+      std::vector<uint32_t> writer(activations, none); // last task to add into each activation
+      std::vector<std::vector<uint32_t>> deps(n);
+      std::vector<size_t> reads;
+      uint32_t barrier = none; // last task holding a record that didn't declare its inputs
+      size_t since = 0; // tasks at or after this index haven't been waited on by a barrier yet
+      for (size_t r = 0; r < records.size(); ++r) {
+        uint32_t k = uint32_t(r / grain);
+        auto & d = deps[k];
+        if (r % grain == 0 && barrier != none) d.push_back(barrier);
+        size_t lo = ends[r] - records[r]->activations();
+        for (size_t j = lo; j < ends[r]; ++j) if (writer[j] != none && writer[j] != k) d.push_back(writer[j]);
+        reads.clear();
+        if (records[r]->inputs(lo, reads)) {
+          for (auto j : reads) {
+            assert(j < lo);
+            if (writer[j] != none && writer[j] != k) d.push_back(writer[j]);
+            writer[j] = k;
+          }
+        } else {
+          for (size_t e = since; e < k; ++e) d.push_back(uint32_t(e));
+          barrier = k;
+          since = k;
+        }
+      }
+      indegree.assign(n, 0);
+      first.assign(n + 1, 0);
+      for (size_t k = 0; k < n; ++k) {
+        auto & d = deps[k];
+        std::sort(d.begin(), d.end());
+        d.erase(std::unique(d.begin(), d.end()), d.end());
+        indegree[k] = uint32_t(d.size());
+        for (auto e : d) ++first[e + 1];
+      }
+      for (size_t k = 0; k < n; ++k) first[k + 1] += first[k];
+      successors.resize(first[n]);
+      std::vector<uint32_t> fill(first.begin(), first.end() - 1);
+      for (size_t k = 0; k < n; ++k) for (auto e : deps[k]) successors[fill[e]++] = uint32_t(k);
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef BAD_TAPES_PIPELINE_HH
+#define BAD_TAPES_PIPELINE_HH
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief overlapping the reverse sweep of one batch with the recording of the next
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  /// \brief a rotating set of tapes and a worker thread that sweeps each one while the next is being recorded.
+  ///
+  /// \ref acquire hands out an empty tape to record batch `N+1` into, while the worker is still busy with
+  /// batch `N`. \ref submit queues a finished tape for its reverse sweep and returns a future for the gradient:
+  ///
+  /// ~~~{.cc}
+  /// sweep_pipeline<double> pipe; // double-buffered
+  /// std::future<adjoints<double>> pending;
+  /// for (auto & batch : batches) {
+  ///   auto & t = pipe.acquire();
+  ///   size_t loss = record(t, batch, params);
+  ///   if (pending.valid()) update(params, pending.get());
+  ///   pending = pipe.submit(t, loss);
+  /// }
+  /// update(params, pending.get());
+  /// ~~~
+  ///
+  /// The pipeline owns `depth` tapes, and a tape only goes back into rotation once its sweep is done, so at
+  /// most `depth` tapes are queued or being swept and \ref acquire blocks while all of them are. Tapes are
+  /// cleared in \ref acquire, on the recording thread, so their slabs stay with that thread's
+  /// \ref bad::tapes::segment_pool "segment_pool" and a warmed up pipeline records without allocating.
+  /// \ingroup tapes_group
+  template <class T, class Act = T*, class Allocator = default_allocator, class Dispatch = virtual_dispatch>
+  struct sweep_pipeline {
+    using tape_type = tape<T, Act, Allocator>;
+    using adjoint_type = typename tape_type::adjoint_type;
+    using result_type = adjoints<adjoint_type>;
+
+    BAD(hd) explicit
+    sweep_pipeline(size_t depth = 2, Dispatch step = Dispatch()) noexcept
+    : step(std::move(step))
+    , tapes(std::max<size_t>(depth, 1))
+    , stopping(false) {
+      for (auto & t : tapes) available.push_back(&t);
+      worker = std::thread([this] { work(); });
+    }
+
+    BAD(hd)
+    sweep_pipeline(sweep_pipeline const &) = delete;
+
+    BAD(hd)
+    sweep_pipeline & operator = (sweep_pipeline const &) = delete;
+
+    /// finishes every submitted sweep before returning
+    BAD(hd)
+    ~sweep_pipeline() noexcept {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      ready.notify_one();
+      worker.join();
+    }
+
+    /// number of tapes in rotation
+    BAD(hd,pure)
+    size_t depth() const noexcept {
+      return tapes.size();
+    }
+
+    /// an empty tape to record into, waiting for a sweep to finish if every tape is in flight
+    BAD(hd)
+    tape_type & acquire() noexcept {
+      tape_type * t;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        freed.wait(lock, [this] { return !available.empty(); });
+        t = available.back();
+        available.pop_back();
+      }
+      t->clear();
+      return *t;
+    }
+
+    /// queue `t`, which came from \ref acquire, for a reverse sweep seeded at activation `output`.
+    ///
+    /// `t` belongs to the worker until the future is ready, and must not be touched until then.
+    BAD(hd,nodiscard)
+    std::future<result_type> submit(BAD(noescape) tape_type & t, size_t output, adjoint_type seed = adjoint_type(1)) noexcept {
+      assert(&t >= tapes.data() && &t < tapes.data() + tapes.size());
+      assert(output < t.activations);
+      std::promise<result_type> promise;
+      auto result = promise.get_future();
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back({ &t, output, seed, std::move(promise) });
+      }
+      ready.notify_one();
+      return result;
+    }
+
+  private:
+    /// a tape waiting for its sweep
+    struct job {
+      tape_type * tape;
+      size_t output;
+      adjoint_type seed;
+      std::promise<result_type> promise;
+    };
+
+    BAD(hd)
+    void work() noexcept {
+      for (;;) {
+        job j;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          ready.wait(lock, [this] { return stopping || !jobs.empty(); });
+          if (jobs.empty()) return; // stopping, with nothing left to sweep
+          j = std::move(jobs.front());
+          jobs.pop_front();
+        }
+        result_type result;
+        j.tape->backprop(result, j.output, j.seed, step);
+        j.promise.set_value(std::move(result));
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          available.push_back(j.tape);
+        }
+        freed.notify_one();
+      }
+    }
+
+    BAD(no_unique_address)
+    Dispatch step;
+    std::vector<tape_type> tapes; // never resized, so acquired references stay valid
+    std::vector<tape_type *> available; // tapes not queued or being swept
+    std::deque<job> jobs; // oldest first
+    std::mutex mutex;
+    std::condition_variable ready; // a job arrived, or we're stopping
+    std::condition_variable freed; // a tape became available
+    std::thread worker;
+    bool stopping;
+  };
+}
+
+#endif
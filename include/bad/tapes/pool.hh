@@ -0,0 +1,124 @@
+#ifndef BAD_TAPES_POOL_HH
+#define BAD_TAPES_POOL_HH
+
+#include <cstddef>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/common.hh"
+#include "bad/memory.hh"
+
+/// \file
+/// \brief per-thread recycling of tape segments
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  /// \brief a per-thread cache of retired segment slabs.
+  ///
+  /// \ref bad::tapes::detail::segment "segments" draw their memory from here, and hand it back when they die,
+  /// so a training loop that records and discards a similarly sized tape every iteration stops
+  /// touching `Allocator` once the pool has warmed up.
+  ///
+  /// The pool keeps at most `high_water_slabs` slabs and `high_water_bytes` bytes. Anything released past
+  /// either mark goes straight back to `Allocator`. Set both to 0 to disable caching on this thread.
+  /// \ingroup tapes_group
+  template <class Allocator = default_allocator>
+  struct segment_pool final {
+    /// a cached slab
+    struct slab {
+      std::byte * memory;
+      size_t size;
+    };
+
+    BAD(no_unique_address)
+    Allocator allocator; ///< stateless allocator
+
+    std::vector<slab> slabs; ///< cached slabs, most recently released last
+    size_t bytes; ///< total size of cached slabs
+    size_t high_water_slabs; ///< cache at most this many slabs
+    size_t high_water_bytes; ///< cache at most this many bytes
+    size_t misses; ///< number of times we've had to go to the allocator
+
+    static constexpr size_t default_high_water_slabs = 256;
+    static constexpr size_t default_high_water_bytes = size_t(64) << 20;
+
+    BAD(hd)
+    segment_pool() noexcept
+    : slabs()
+    , bytes(0)
+    , high_water_slabs(default_high_water_slabs)
+    , high_water_bytes(default_high_water_bytes)
+    , misses(0) {}
+
+    BAD(hd)
+    segment_pool(segment_pool const &) = delete;
+
+    BAD(hd)
+    segment_pool & operator = (segment_pool const &) = delete;
+
+    BAD(hd)
+    ~segment_pool() noexcept {
+      trim(0);
+    }
+
+    /// the pool for the current thread
+    BAD(hd)
+    static segment_pool & local() noexcept {
+      static thread_local segment_pool pool;
+      return pool;
+    }
+
+    /// obtain a slab of at least `n` bytes. on return `n` holds the actual size of the slab.
+    ///
+    /// `n` should be padded out to the alignment of the records the slab will hold.
+    BAD(hd,nodiscard,assume_aligned(record_alignment),returns_nonnull)
+    std::byte * acquire(BAD(noescape) size_t & n) noexcept {
+      // smallest cached slab that fits with at most a quarter to spare, preferring the most recently
+      // released among equals. being any looser lets a growth policy that sizes each segment from the
+      // last one ratchet up through the pool
+      size_t best = slabs.size();
+      for (size_t k = slabs.size(); k-- > 0;) {
+        size_t s = slabs[k].size;
+        if (s >= n && s - n <= n / 4 && (best == slabs.size() || s < slabs[best].size)) {
+          best = k;
+          if (s == n) break;
+        }
+      }
+      if (best != slabs.size()) {
+        slab result = slabs[best];
+        slabs[best] = slabs.back();
+        slabs.pop_back();
+        bytes -= result.size;
+        n = result.size;
+        return result.memory;
+      }
+      ++misses;
+      return allocator.allocate(n);
+    }
+
+    /// retire a slab of `n` bytes obtained from \ref acquire
+    BAD(hd,noalias)
+    void release(BAD(noescape) std::byte * memory, size_t n) noexcept {
+      if (slabs.size() < high_water_slabs && bytes + n <= high_water_bytes) {
+        slabs.push_back({memory, n});
+        bytes += n;
+      } else {
+        allocator.deallocate(memory, n);
+      }
+    }
+
+    /// return cached slabs to the allocator until at most `keep` bytes remain cached
+    BAD(hd,noalias)
+    void trim(size_t keep = 0) noexcept {
+      while (bytes > keep && !slabs.empty()) {
+        slab s = slabs.back();
+        slabs.pop_back();
+        bytes -= s.size;
+        allocator.deallocate(s.memory, s.size);
+      }
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef BAD_TAPES_REMAT_HH
+#define BAD_TAPES_REMAT_HH
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/memory.hh"
+
+/// \file
+/// \brief dynamic tensor rematerialization for values saved by tape records
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  struct remat_runtime;
+
+  /// \brief a saved value that can be dropped under memory pressure and recomputed when next needed.
+  ///
+  /// See \ref remat for the usual way to define one.
+  /// \ingroup tapes_group
+  struct rematerializable {
+    remat_runtime & runtime; ///< who decides when we get dropped
+    size_t bytes; ///< size of the value when resident
+    double cost; ///< seconds it took to compute last time, not counting parents
+    uint64_t last_access; ///< runtime clock at our last \ref remat::get "get"
+    size_t index; ///< position in runtime.values
+    uint32_t pins; ///< nonzero while something is computing with us
+    bool resident; ///< do we currently hold the value
+    std::vector<rematerializable *> parents; ///< values our computation read, discovered as we compute
+    std::vector<rematerializable *> children; ///< values whose computation read us, so we can leave their parents
+    rematerializable * older; ///< previous resident value in least recently used order
+    rematerializable * newer; ///< next resident value in least recently used order
+
+    BAD(hd)
+    rematerializable(remat_runtime & runtime, size_t bytes) noexcept;
+
+    BAD(hd)
+    rematerializable(rematerializable const &) = delete;
+
+    BAD(hd)
+    rematerializable & operator = (rematerializable const &) = delete;
+
+    BAD(hd)
+    virtual ~rematerializable() noexcept;
+
+    /// drop the value, keeping enough to recompute it
+    BAD(hd,noalias)
+    virtual void release() noexcept = 0;
+
+    /// the DTR eviction score, lower is evicted first.
+    ///
+    /// the cost of bringing us back, plus that of any parents that have already been dropped, since those
+    /// would have to be recomputed along with us, divided by how much memory we free times how long it has
+    /// been since we were last used.
+    BAD(hd,pure)
+    double score(uint64_t now) const noexcept {
+      double c = cost;
+      for (auto p : parents) if (!p->resident) c += p->cost;
+      double staleness = double(now - last_access + 1);
+      return c / (double(bytes) * staleness);
+    }
+  };
+
+  /// \brief a dynamic tensor rematerialization runtime.
+  ///
+  /// Keeps the values registered with it under `budget` bytes by evicting whichever resident, unpinned
+  /// value has the lowest \ref rematerializable::score "score" each time room is needed. Evicted values
+  /// are recomputed the next time they are read, recursively recomputing any evicted parents first.
+  ///
+  /// Resident values are kept in least recently used order, and only the `window` stalest unpinned ones
+  /// are scored, so finding a victim doesn't cost a scan of everything that was ever registered.
+  ///
+  /// Not thread-safe. Use one runtime per thread.
+  /// \ingroup tapes_group
+  struct remat_runtime {
+    size_t budget; ///< try to keep at most this many bytes resident
+    size_t resident; ///< bytes currently resident
+    uint64_t clock; ///< ticks once per access
+    size_t evictions; ///< number of values dropped to make room
+    size_t recomputes; ///< number of times a dropped value had to be computed again
+    double recompute_cost; ///< total seconds spent recomputing dropped values
+    std::vector<rematerializable *> values; ///< everything registered with us
+    std::vector<rematerializable *> pinned; ///< values in use by computations still in progress
+    rematerializable * computing; ///< innermost value being computed, if any
+    double nested; ///< seconds spent computing parents during the current computation
+    rematerializable * oldest; ///< least recently used resident value
+    rematerializable * newest; ///< most recently used resident value
+    size_t window; ///< how many of the least recently used unpinned values to score when evicting
+
+    BAD(hd)
+    explicit remat_runtime(size_t budget = std::numeric_limits<size_t>::max(), size_t window = 32) noexcept
+    : budget(budget)
+    , resident(0)
+    , clock(0)
+    , evictions(0)
+    , recomputes(0)
+    , recompute_cost(0)
+    , values()
+    , pinned()
+    , computing(nullptr)
+    , nested(0)
+    , oldest(nullptr)
+    , newest(nullptr)
+    , window(window) {}
+
+    BAD(hd)
+    remat_runtime(remat_runtime const &) = delete;
+
+    BAD(hd)
+    remat_runtime & operator = (remat_runtime const &) = delete;
+
+    /// evict values until `bytes` more will fit under the budget, or we run out of candidates
+    BAD(hd,noalias)
+    void reserve(size_t bytes) noexcept {
+      while (resident + bytes > budget) {
+        rematerializable * victim = nullptr;
+        double best = std::numeric_limits<double>::infinity();
+        size_t seen = 0;
+        for (auto v = oldest; v != nullptr && seen < window; v = v->newer) {
+          if (v->pins != 0) continue;
+          ++seen;
+          double s = v->score(clock);
+          if (victim == nullptr || s < best) {
+            victim = v;
+            best = s;
+          }
+        }
+        if (victim == nullptr) return; // everything is in use, go over budget
+        evict(*victim);
+      }
+    }
+
+    /// drop a resident value
+    BAD(hd,noalias)
+    void evict(BAD(noescape) rematerializable & v) noexcept {
+      assert(v.resident && v.pins == 0);
+      v.release();
+      v.resident = false;
+      resident -= v.bytes;
+      unlink(v);
+      ++evictions;
+    }
+
+    /// mark a resident value as the most recently used
+    BAD(hd,noalias)
+    void touch(BAD(noescape) rematerializable & v) noexcept {
+      if (newest == &v) return;
+      unlink(v);
+      link(v);
+    }
+
+    /// add a newly resident value as the most recently used
+    BAD(hd,noalias)
+    void link(BAD(noescape) rematerializable & v) noexcept {
+      v.older = newest;
+      v.newer = nullptr;
+      if (newest != nullptr) newest->newer = &v;
+      else oldest = &v;
+      newest = &v;
+    }
+
+    /// remove a value from the least recently used order
+    BAD(hd,noalias)
+    void unlink(BAD(noescape) rematerializable & v) noexcept {
+      if (v.older != nullptr) v.older->newer = v.newer;
+      else oldest = v.newer;
+      if (v.newer != nullptr) v.newer->older = v.older;
+      else newest = v.older;
+      v.older = v.newer = nullptr;
+    }
+
+    /// lower the budget, evicting as needed
+    BAD(hd,noalias)
+    void set_budget(size_t n) noexcept {
+      budget = n;
+      reserve(0);
+    }
+  };
+
+  inline rematerializable::rematerializable(remat_runtime & runtime, size_t bytes) noexcept
+  : runtime(runtime)
+  , bytes(bytes)
+  , cost(0)
+  , last_access(0)
+  , index(runtime.values.size())
+  , pins(0)
+  , resident(false)
+  , parents()
+  , children()
+  , older(nullptr)
+  , newer(nullptr) {
+    runtime.values.push_back(this);
+  }
+
+  inline rematerializable::~rematerializable() noexcept {
+    assert(pins == 0);
+    if (resident) {
+      runtime.resident -= bytes;
+      runtime.unlink(*this);
+    }
+    auto & vs = runtime.values;
+    vs[index] = vs.back();
+    vs[index]->index = index;
+    vs.pop_back();
+    // only our neighbours know about us
+    for (auto p : parents) {
+      auto & cs = p->children;
+      cs.erase(std::remove(cs.begin(), cs.end(), this), cs.end());
+    }
+    for (auto c : children) {
+      auto & ps = c->parents;
+      ps.erase(std::remove(ps.begin(), ps.end(), this), ps.end());
+    }
+  }
+
+  /// \brief a rematerializable array of `n` values of type `T`.
+  ///
+  /// `B` supplies `void compute(T * out) const noexcept`, which may read other \ref remat values through
+  /// their `get()`. Records save a pointer to one of these instead of a copy of the value, and call
+  /// `get()` from `prop`:
+  ///
+  /// ~~~{.cc}
+  /// struct layer : remat<double, layer> {
+  ///   layer * input;
+  ///   layer(remat_runtime & rt, size_t n, layer * input) noexcept : remat(rt, n), input(input) {}
+  ///   void compute(double * out) const noexcept {
+  ///     double const * x = input->get();
+  ///     for (size_t j=0;j<n;++j) out[j] = std::tanh(x[j]);
+  ///   }
+  /// };
+  /// ~~~
+  ///
+  /// The pointer returned by `get()` stays valid until the next `get()` on the same runtime, which might
+  /// evict it. Values read by `compute` are pinned until it returns.
+  /// \ingroup tapes_group
+  template <class T, class B>
+  struct remat : rematerializable {
+    size_t n; ///< number of elements
+    T * data; ///< the value, or nullptr when dropped
+
+    BAD(hd)
+    remat(remat_runtime & runtime, size_t n) noexcept
+    : rematerializable(runtime, n * sizeof(T))
+    , n(n)
+    , data(nullptr) {}
+
+    BAD(hd)
+    ~remat() noexcept override {
+      if (data != nullptr) allocator().deallocate(data);
+    }
+
+    BAD(hd,noalias)
+    void release() noexcept override {
+      allocator().deallocate(data);
+      data = nullptr;
+    }
+
+    /// the value, computing it first if it has been dropped or has never been computed
+    BAD(hd,returns_nonnull)
+    T const * get() noexcept {
+      remat_runtime & rt = runtime;
+      last_access = ++rt.clock;
+      if (rt.computing != nullptr) {
+        // someone is computing with us, stay put until they are done
+        ++pins;
+        rt.pinned.push_back(this);
+        auto & ps = rt.computing->parents;
+        if (std::find(ps.begin(), ps.end(), this) == ps.end()) {
+          ps.push_back(this);
+          children.push_back(rt.computing);
+        }
+      }
+      if (resident) rt.touch(*this);
+      else materialize();
+      return data;
+    }
+
+  private:
+    BAD(hd,noalias)
+    void materialize() noexcept {
+      remat_runtime & rt = runtime;
+      bool again = cost != 0;
+      ++pins;
+      rt.reserve(bytes);
+      data = allocator().allocate(n);
+      resident = true;
+      rt.resident += bytes;
+      rt.link(*this);
+
+      auto outer = rt.computing;
+      double outer_nested = rt.nested;
+      size_t mark = rt.pinned.size();
+      rt.computing = this;
+      rt.nested = 0;
+      auto start = std::chrono::steady_clock::now();
+      static_cast<B const *>(this)->compute(data);
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      // parents are charged for their own recomputation
+      cost = std::max(elapsed - rt.nested, std::numeric_limits<double>::min());
+      rt.computing = outer;
+      rt.nested = outer_nested + elapsed;
+      while (rt.pinned.size() > mark) {
+        --rt.pinned.back()->pins;
+        rt.pinned.pop_back();
+      }
+      // recomputing a chain of dropped parents can take us over budget, get back under it now they're free
+      rt.reserve(0);
+      --pins;
+
+      if (again) {
+        ++rt.recomputes;
+        rt.recompute_cost += cost;
+      }
+    }
+
+    BAD(hd,const)
+    static aligned_allocator<T, cache_line_size> allocator() noexcept { return {}; }
+  };
+}
+
+#endif
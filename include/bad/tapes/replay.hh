@@ -0,0 +1,82 @@
+#ifndef BAD_TAPES_REPLAY_HH
+#define BAD_TAPES_REPLAY_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief re-evaluating a recorded tape at new inputs
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  /// \brief the records of a tape in the order they were pushed, so the recorded computation can be run
+  /// forward again at new inputs.
+  ///
+  /// Record once, then for each new point write its inputs into `values` and call the plan. Each record's
+  /// \ref bad::tapes::abstract_record::replay "replay" recomputes its activations and refreshes the partials
+  /// it saved, after which the tape sweeps as if it had been recorded at the new point:
+  ///
+  /// ~~~{.cc}
+  /// replay_plan plan(t);
+  /// std::vector<double> values(t.activations);
+  /// for (auto & [x, y] : points) {
+  ///   values[0] = x;
+  ///   values[1] = y;
+  ///   plan(values.data());
+  ///   t.backprop(grad, t.activations - 1);
+  /// }
+  /// ~~~
+  ///
+  /// Only records that implement `replay` can take part. The control flow is frozen at recording time,
+  /// so branches taken on primal values are not revisited. Spliced sections number their activations from
+  /// their own base, so a plan built from a tape with \ref bad::tapes::tape::sections "sections" is empty
+  /// and refuses to run. The plan describes the tape as it was when it was built. Build a new one after
+  /// pushing more records.
+  /// \ingroup tapes_group
+  template <class T, class Act = T*, class Allocator = default_allocator>
+  struct replay_plan {
+    using tape_type = tape<T, Act, Allocator>;
+    using abstract_record_type = abstract_record<T, Act, Allocator>;
+
+    std::vector<abstract_record_type *> records; ///< oldest first
+    std::vector<size_t> starts; ///< first activation owned by each record
+    size_t activations; ///< of the tape
+    bool replayable; ///< false if the tape had spliced sections, in which case there is nothing to run
+
+    BAD(hd)
+    explicit replay_plan(BAD(noescape) tape_type & t) noexcept
+    : activations(t.activations)
+    , replayable(t.sections.empty()) {
+      if (!replayable) return;
+      size_t i = t.activations;
+      for (auto s = t.segment.memory ? &t.segment : nullptr; s != nullptr; s = s->next_segment()) {
+        for (abstract_record_type * p = s->current, * b = s->boundary(); p != b; p = p->next()) {
+          i -= p->activations();
+          records.push_back(p);
+          starts.push_back(i);
+        }
+      }
+      assert(i == t.base);
+      std::reverse(records.begin(), records.end());
+      std::reverse(starts.begin(), starts.end());
+    }
+
+    /// run every record forward over `values`, which holds one primal value per activation, inputs
+    /// already filled in. returns false, leaving later records untouched, if some record can't be replayed,
+    /// or without running any if the tape wasn't \ref replayable.
+    BAD(hd)
+    bool operator()(T * values) const noexcept {
+      if (!replayable) return false;
+      for (size_t r = 0; r < records.size(); ++r)
+        if (!records[r]->replay(values, starts[r])) return false;
+      return true;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef BAD_TAPES_REVOLVE_HH
+#define BAD_TAPES_REVOLVE_HH
+
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief binomial checkpointing for time-stepped loops
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  namespace detail {
+    /// \f$\binom{c+r}{c}\f$, the most steps `c` snapshots can reverse while running each step forward at most
+    /// `r` extra times. saturates rather than overflowing.
+    /// \ingroup tapes_group
+    BAD(hd,const) constexpr
+    inline size_t binomial_steps(size_t c, size_t r) noexcept {
+      size_t result = 1;
+      for (size_t k = 1; k <= c; ++k) {
+        // result * (r + k) / k stays exact at every step
+        if (result > std::numeric_limits<size_t>::max() / (r + k)) return std::numeric_limits<size_t>::max();
+        result = result * (r + k) / k;
+      }
+      return result;
+    }
+
+    /// where the binomial schedule puts the next snapshot when reversing `n > 1` steps with `c > 0` snapshots
+    /// \ingroup tapes_group
+    BAD(hd,const) constexpr
+    inline size_t binomial_split(size_t n, size_t c) noexcept {
+      size_t r = 0;
+      while (binomial_steps(c, r) < n) ++r;
+      // the last binomial_steps(c-1,r) steps reverse with one fewer snapshot, the rest with one fewer repeat
+      size_t right = std::min(n - 1, binomial_steps(c - 1, r));
+      return n - right;
+    }
+
+    /// the nullary record that introduces each component of the loop state on a step's private tape
+    /// \ingroup tapes_group
+    template <class T, class Act, class Allocator>
+    struct loop_input final : static_record<1, loop_input<T, Act, Allocator>, T, Act, Allocator> {
+      BAD(hd,inline,const)
+      void prop(BAD(maybe_unused) Act, BAD(maybe_unused) size_t) const noexcept {}
+    };
+  }
+
+  /// \brief a loop of `steps` identical timesteps, pushed as a single record.
+  ///
+  /// Only the initial state is kept on the tape. The reverse sweep replays the loop under the binomial
+  /// (revolve) schedule, holding at most `snapshots` copies of `State` at once, and re-records each step
+  /// onto a private tape just before it is reversed. Memory is \f$O(\text{snapshots})\f$ states rather than
+  /// \f$O(\text{steps})\f$ recorded steps, at the cost of running each step forward \f$O(\log \text{steps})\f$
+  /// more times with the default number of snapshots.
+  ///
+  /// `Body` supplies
+  ///
+  /// * `void advance(State & s) const`, one step without recording
+  /// * `void record(tape<T,Act,Allocator> & t, State const & s, size_t * out) const`, one step recorded onto
+  ///   `t`, where activations `0 .. d-1` already stand for the components of `s`. It writes the activations
+  ///   of the components of the next state to `out[0 .. d-1]`.
+  ///
+  /// See \ref checkpointed_loop.
+  /// \ingroup tapes_group
+  template <class State, class Body, class T, class Act = T*, class Allocator = default_allocator>
+  struct loop_record final : record<loop_record<State, Body, T, Act, Allocator>, T, Act, Allocator> {
+    static_assert(std::is_pointer_v<Act>, "checkpointed loops need a pointer activation type");
+
+    using tape_type = tape<T, Act, Allocator>;
+    using adjoint_type = typename tape_type::adjoint_type;
+
+    State initial; ///< the state going into the first step
+    size_t steps; ///< number of steps
+    size_t snapshots; ///< most states to keep at once, not counting `initial`
+    std::vector<size_t> inputs; ///< outer activations for the components of `initial`
+    Body body;
+
+    BAD(hd)
+    loop_record(State initial, size_t steps, size_t snapshots, std::vector<size_t> inputs, Body body) noexcept
+    : initial(std::move(initial))
+    , steps(steps)
+    , snapshots(snapshots)
+    , inputs(std::move(inputs))
+    , body(std::move(body)) {}
+
+    /// one for each component of the final state
+    BAD(hd,inline,pure)
+    size_t activations() const noexcept override {
+      return inputs.size();
+    }
+
+    BAD(hd)
+    void prop(Act act, size_t i) const noexcept {
+      size_t d = inputs.size();
+      std::vector<adjoint_type> lambda(act + i, act + i + d);
+      scratch s { tape_type(), adjoints<adjoint_type>(), std::vector<size_t>(d) };
+      if (steps > 0) reverse(s, lambda, initial, 0, steps, snapshots);
+      for (size_t j = 0; j < d; ++j) act[inputs[j]] += lambda[j];
+    }
+
+  private:
+    /// reused by every step of one sweep
+    struct scratch {
+      tape_type tape;
+      adjoints<adjoint_type> adjoint;
+      std::vector<size_t> out;
+    };
+
+    /// re-record the step out of `state` and pull `lambda` back through it
+    BAD(hd)
+    void reverse_step(BAD(noescape) scratch & s, BAD(noescape) std::vector<adjoint_type> & lambda, State const & state) const noexcept {
+      size_t d = inputs.size();
+      s.tape.clear();
+      for (size_t j = 0; j < d; ++j) s.tape.template push<detail::loop_input<T, Act, Allocator>>();
+      body.record(s.tape, state, s.out.data());
+      s.adjoint.reset(s.tape.activations);
+      for (size_t j = 0; j < d; ++j) s.adjoint[s.out[j]] += lambda[j];
+      s.tape.sweep(s.adjoint.data());
+      for (size_t j = 0; j < d; ++j) lambda[j] = s.adjoint[j];
+    }
+
+    /// reverse steps `[lo, hi)` given the state at `lo`, with `c` snapshots to spare
+    BAD(hd)
+    void reverse(
+      BAD(noescape) scratch & s,
+      BAD(noescape) std::vector<adjoint_type> & lambda,
+      State const & state,
+      size_t lo,
+      size_t hi,
+      size_t c
+    ) const noexcept {
+      while (hi - lo > 1) {
+        if (c == 0) {
+          // out of snapshots: run forward from lo for each step we reverse
+          State x = state;
+          for (size_t k = lo; k + 1 < hi; ++k) body.advance(x);
+          reverse_step(s, lambda, x);
+          --hi;
+          continue;
+        }
+        size_t mid = lo + detail::binomial_split(hi - lo, c);
+        State snapshot = state;
+        for (size_t k = lo; k < mid; ++k) body.advance(snapshot);
+        reverse(s, lambda, snapshot, mid, hi, c - 1);
+        hi = mid;
+      }
+      reverse_step(s, lambda, state);
+    }
+  };
+
+  /// \brief run `steps` timesteps of `body` on `state` and push a single \ref loop_record for all of them.
+  ///
+  /// `inputs[j]` is the activation on `t` that the j-th component of `state` came from. On return `state`
+  /// holds the final state, whose components are the `inputs.size()` activations starting at the returned
+  /// index.
+  ///
+  /// `snapshots` defaults to about \f$\log_2 \text{steps}\f$, which bounds the recomputation to a
+  /// logarithmic number of extra forward passes over each step.
+  /// \ingroup tapes_group
+  template <class State, class Body, class T, class Act, class Allocator>
+  BAD(hd)
+  size_t checkpointed_loop(
+    BAD(noescape) tape<T, Act, Allocator> & t,
+    BAD(noescape) State & state,
+    size_t steps,
+    std::vector<size_t> inputs,
+    Body body,
+    size_t snapshots = 0
+  ) noexcept {
+    if (snapshots == 0) while (size_t(1) << snapshots < steps) ++snapshots;
+    State initial = state;
+    for (size_t k = 0; k < steps; ++k) body.advance(state);
+    size_t first = t.activations;
+    t.template push<loop_record<State, Body, T, Act, Allocator>>(std::move(initial), steps, snapshots, std::move(inputs), std::move(body));
+    return first;
+  }
+}
+
+#endif
@@ -0,0 +1,448 @@
+#ifndef BAD_TAPES_SPARSE_HH
+#define BAD_TAPES_SPARSE_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/tapes/hvp.hh"
+#include "bad/tapes/lanes.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief sparse Jacobians and Hessians by sparsity detection, coloring, and compressed sweeps
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  /// \brief which entries of a Jacobian or Hessian can be nonzero, in compressed sparse row form.
+  /// \ingroup tapes_group
+  struct sparsity_pattern {
+    size_t rows = 0; ///< number of outputs
+    size_t cols = 0; ///< number of inputs
+    std::vector<size_t> first; ///< the entries of row `r` are `columns[first[r] .. first[r+1])`
+    std::vector<uint32_t> columns; ///< column of each entry, ascending within a row
+
+    BAD(hd,pure)
+    size_t nonzeros() const noexcept {
+      return columns.size();
+    }
+  };
+
+  /// \brief find the sparsity pattern of the Jacobian of `outputs` with respect to `inputs` from what the
+  /// records of `t` declare they read.
+  ///
+  /// Runs forward over the tape once, tracking for each activation the set of inputs it depends on. Every
+  /// activation a record owns is assumed to depend on everything the record reads. Returns false, leaving
+  /// `out` unspecified, if some record doesn't declare its \ref bad::tapes::abstract_record::inputs "inputs",
+  /// or if `t` has spliced \ref bad::tapes::tape::sections "sections", whose records declare their inputs
+  /// in their own numbering.
+  /// \ingroup tapes_group
+  template <class T, class Act, class Allocator>
+  BAD(hd)
+  bool detect_sparsity(
+    BAD(noescape) tape<T, Act, Allocator> const & t,
+    BAD(noescape) std::vector<size_t> const & outputs,
+    BAD(noescape) std::vector<size_t> const & inputs,
+    BAD(noescape) sparsity_pattern & out
+  ) noexcept {
+    using abstract_record_type = abstract_record<T, Act, Allocator>;
+    if (!t.sections.empty()) return false;
+    std::vector<abstract_record_type const *> records;
+    for (auto s = t.segment.memory ? &t.segment : nullptr; s != nullptr; s = s->next_segment())
+      for (abstract_record_type const * p = s->current, * b = s->boundary(); p != b; p = p->next())
+        records.push_back(p);
+
+    std::vector<std::vector<uint32_t>> deps(t.activations);
+    for (size_t c = 0; c < inputs.size(); ++c) {
+      assert(inputs[c] < t.activations);
+      deps[inputs[c]].push_back(uint32_t(c));
+    }
+    std::vector<size_t> reads;
+    std::vector<uint32_t> merged;
+    size_t i = t.base;
+    for (auto r = records.rbegin(); r != records.rend(); ++r) {
+      size_t n = (*r)->activations();
+      reads.clear();
+      if (!(*r)->inputs(i, reads)) return false;
+      merged.clear();
+      for (auto j : reads) {
+        assert(j < i);
+        auto & d = deps[j];
+        size_t mid = merged.size();
+        merged.insert(merged.end(), d.begin(), d.end());
+        std::inplace_merge(merged.begin(), merged.begin() + std::ptrdiff_t(mid), merged.end());
+        merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+      }
+      for (size_t j = i; j < i + n; ++j) {
+        auto & d = deps[j];
+        if (d.empty()) d = merged;
+        else { // an input introduced by this record
+          size_t mid = d.size();
+          d.insert(d.end(), merged.begin(), merged.end());
+          std::inplace_merge(d.begin(), d.begin() + std::ptrdiff_t(mid), d.end());
+          d.erase(std::unique(d.begin(), d.end()), d.end());
+        }
+      }
+      i += n;
+    }
+    assert(i == t.activations);
+
+    out.rows = outputs.size();
+    out.cols = inputs.size();
+    out.first.assign(1, 0);
+    out.columns.clear();
+    for (auto o : outputs) {
+      assert(o < t.activations);
+      out.columns.insert(out.columns.end(), deps[o].begin(), deps[o].end());
+      out.first.push_back(out.columns.size());
+    }
+    return true;
+  }
+
+  /// \brief color the rows of `p` so that no two rows of the same color share a column.
+  ///
+  /// A greedy partial distance-2 coloring of the bipartite row/column graph, visiting the densest rows
+  /// first. Rows of one color can be seeded together in a single reverse sweep without their adjoints
+  /// mixing. Returns the number of colors, at least the most entries in any one column.
+  /// \ingroup tapes_group
+  BAD(hd)
+  inline size_t color_rows(BAD(noescape) sparsity_pattern const & p, BAD(noescape) std::vector<uint32_t> & color) noexcept {
+    constexpr uint32_t none = uint32_t(-1);
+    // rows of each column
+    std::vector<size_t> col_first(p.cols + 1, 0);
+    for (auto c : p.columns) ++col_first[c + 1];
+    std::partial_sum(col_first.begin(), col_first.end(), col_first.begin());
+    std::vector<uint32_t> col_rows(p.columns.size());
+    std::vector<size_t> fill(col_first.begin(), col_first.end() - 1);
+    for (size_t r = 0; r < p.rows; ++r)
+      for (size_t e = p.first[r]; e < p.first[r + 1]; ++e) col_rows[fill[p.columns[e]]++] = uint32_t(r);
+
+    std::vector<uint32_t> order(p.rows);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return p.first[a + 1] - p.first[a] > p.first[b + 1] - p.first[b];
+    });
+    color.assign(p.rows, none);
+    std::vector<uint32_t> forbidden; // forbidden[c] == r + 1 while coloring row r means c is taken
+    size_t colors = 0;
+    for (auto r : order) {
+      for (size_t e = p.first[r]; e < p.first[r + 1]; ++e) {
+        uint32_t c = p.columns[e];
+        for (size_t k = col_first[c]; k < col_first[c + 1]; ++k) {
+          uint32_t q = color[col_rows[k]];
+          if (q != none) forbidden[q] = r + 1;
+        }
+      }
+      uint32_t q = 0;
+      while (q < colors && forbidden[q] == r + 1) ++q;
+      if (q == colors) {
+        ++colors;
+        forbidden.push_back(0);
+      }
+      color[r] = q;
+    }
+    return colors;
+  }
+
+  namespace detail {
+    /// number of adjoints a sweep carries per activation
+    /// \ingroup tapes_group
+    template <class U>
+    struct lane_count_ : constant<size_t(1)> {};
+
+    template <class T, size_t K>
+    struct lane_count_<lanes<T, K>> : constant<K> {};
+
+    template <class T>
+    BAD(hd,inline,pure)
+    T & lane(BAD(noescape) T & x, BAD(maybe_unused) size_t k) noexcept {
+      assert(k == 0);
+      return x;
+    }
+
+    template <class T, size_t K>
+    BAD(hd,inline,pure)
+    T & lane(BAD(noescape) lanes<T, K> & x, size_t k) noexcept {
+      return x[k];
+    }
+  }
+
+  /// \brief a reusable plan for computing a sparse Jacobian by compressed reverse sweeps.
+  ///
+  /// Built once from a tape whose records declare their \ref bad::tapes::abstract_record::inputs "inputs":
+  /// detects the \ref sparsity_pattern, then \ref color_rows "colors" its rows. Each evaluation then seeds
+  /// every output of a color at once, so the Jacobian costs one sweep per color, rather than one per output.
+  /// With `Act = lanes<T,K>*` each sweep handles `K` colors.
+  ///
+  /// Reuse the plan while the tape keeps the same structure, as after \ref bad::tapes::replay_plan "replaying"
+  /// it at new inputs.
+  ///
+  /// If the pattern can't be detected, because some record doesn't declare its inputs or the tape has
+  /// spliced \ref bad::tapes::tape::sections "sections", the plan is empty and refuses to evaluate. Check
+  /// \ref detected, or the result of evaluation, and fall back to \ref jacobian.
+  /// \ingroup tapes_group
+  template <class T, class Act = T*, class Allocator = default_allocator>
+  struct sparse_jacobian {
+    using tape_type = tape<T, Act, Allocator>;
+    using adjoint_type = typename tape_type::adjoint_type;
+    static constexpr size_t width = detail::lane_count_<adjoint_type>::value; ///< colors per sweep
+
+    std::vector<size_t> outputs;
+    std::vector<size_t> inputs;
+    sparsity_pattern pattern;
+    std::vector<uint32_t> color; ///< of each row
+    size_t colors; ///< number of colors
+    std::vector<size_t> color_first; ///< rows of color `c` are `by_color[color_first[c] .. color_first[c+1])`
+    std::vector<uint32_t> by_color;
+    bool detected; ///< false if the sparsity pattern couldn't be detected, in which case there is nothing to evaluate
+
+    BAD(hd)
+    sparse_jacobian(
+      BAD(noescape) tape_type const & t,
+      std::vector<size_t> outputs,
+      std::vector<size_t> inputs
+    ) noexcept
+    : outputs(std::move(outputs))
+    , inputs(std::move(inputs))
+    , colors(0)
+    , detected(detect_sparsity(t, this->outputs, this->inputs, pattern)) {
+      if (!detected) {
+        pattern = sparsity_pattern();
+        return;
+      }
+      colors = bad::tapes::color_rows(pattern, color);
+      color_first.assign(colors + 1, 0);
+      for (auto c : color) ++color_first[c + 1];
+      std::partial_sum(color_first.begin(), color_first.end(), color_first.begin());
+      by_color.resize(pattern.rows);
+      std::vector<size_t> fill(color_first.begin(), color_first.end() - 1);
+      for (size_t r = 0; r < pattern.rows; ++r) by_color[fill[color[r]]++] = uint32_t(r);
+    }
+
+    /// number of reverse sweeps each evaluation takes
+    BAD(hd,pure)
+    size_t sweeps() const noexcept {
+      return (colors + width - 1) / width;
+    }
+
+    /// evaluate the Jacobian of `t`, writing one value per entry of `pattern` to `values`, in the same order.
+    /// returns false, touching nothing, if the pattern wasn't \ref detected
+    template <class Dispatch = virtual_dispatch>
+    BAD(hd)
+    bool operator()(
+      BAD(noescape) tape_type const & t,
+      BAD(noescape) std::vector<T> & values,
+      BAD(noescape) adjoints<adjoint_type> & buffer,
+      BAD(noescape) Dispatch const & step = Dispatch()
+    ) const noexcept {
+      static_assert(std::is_pointer_v<Act>, "sparse jacobians need a pointer activation type");
+      if (!detected) return false;
+      values.resize(pattern.nonzeros());
+      for (size_t lo = 0; lo < colors; lo += width) {
+        size_t hi = std::min(colors, lo + width);
+        buffer.reset(t.activations);
+        for (size_t c = lo; c < hi; ++c)
+          for (size_t k = color_first[c]; k < color_first[c + 1]; ++k)
+            detail::lane(buffer[outputs[by_color[k]]], c - lo) = T(1);
+        t.sweep(buffer.data(), step);
+        for (size_t c = lo; c < hi; ++c)
+          for (size_t k = color_first[c]; k < color_first[c + 1]; ++k) {
+            size_t r = by_color[k];
+            for (size_t e = pattern.first[r]; e < pattern.first[r + 1]; ++e)
+              values[e] = detail::lane(buffer[inputs[pattern.columns[e]]], c - lo);
+          }
+      }
+      return true;
+    }
+  };
+
+  namespace detail {
+    /// the pattern with row `j` holding `adjacent[j]` and `j` itself, which are sorted and deduplicated
+    /// in place. symmetric if `adjacent` is
+    /// \ingroup tapes_group
+    BAD(hd)
+    inline void symmetric_pattern(
+      BAD(noescape) std::vector<std::vector<uint32_t>> & adjacent,
+      BAD(noescape) sparsity_pattern & out
+    ) noexcept {
+      out.rows = out.cols = adjacent.size();
+      out.first.assign(1, 0);
+      out.columns.clear();
+      for (size_t j = 0; j < adjacent.size(); ++j) {
+        auto & a = adjacent[j];
+        a.push_back(uint32_t(j));
+        std::sort(a.begin(), a.end());
+        a.erase(std::unique(a.begin(), a.end()), a.end());
+        out.columns.insert(out.columns.end(), a.begin(), a.end());
+        out.first.push_back(out.columns.size());
+      }
+    }
+  }
+
+  /// \brief the pattern of the Hessian of any weighted sum of the outputs of `elements`, a
+  /// \ref detect_sparsity "Jacobian pattern", as for a partially separable objective or a Lagrangian.
+  ///
+  /// Every two inputs that one output depends on are assumed to interact, and so is every input with itself.
+  /// The result is symmetric, with one row and column per input.
+  /// \ingroup tapes_group
+  BAD(hd)
+  inline void hessian_sparsity(BAD(noescape) sparsity_pattern const & elements, BAD(noescape) sparsity_pattern & out) noexcept {
+    std::vector<std::vector<uint32_t>> adjacent(elements.cols);
+    for (size_t r = 0; r < elements.rows; ++r) {
+      auto lo = elements.columns.begin() + std::ptrdiff_t(elements.first[r]);
+      auto hi = elements.columns.begin() + std::ptrdiff_t(elements.first[r + 1]);
+      for (auto c = lo; c != hi; ++c) adjacent[*c].insert(adjacent[*c].end(), lo, hi);
+    }
+    detail::symmetric_pattern(adjacent, out);
+  }
+
+  /// \brief color the inputs of the symmetric pattern `p` so that every path through four of them in its
+  /// graph takes at least three colors.
+  ///
+  /// A greedy star coloring, visiting the densest rows first and ignoring the diagonal. Beyond neighbours
+  /// getting different colors, an input avoids the color of any `x` two steps away through `w` if that
+  /// would leave a path through `x` and `w` in just two colors. Returns the number of colors. This can be far
+  /// fewer than a distance-2 coloring needs: an arrowhead takes two, rather than one per input.
+  /// \ingroup tapes_group
+  BAD(hd)
+  inline size_t star_color(BAD(noescape) sparsity_pattern const & p, BAD(noescape) std::vector<uint32_t> & color) noexcept {
+    constexpr uint32_t none = uint32_t(-1);
+    assert(p.rows == p.cols);
+    auto neighbours = [&](uint32_t u, auto && k) {
+      for (size_t e = p.first[u]; e < p.first[u + 1]; ++e)
+        if (p.columns[e] != u) k(p.columns[e]);
+    };
+    std::vector<uint32_t> order(p.rows);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return p.first[a + 1] - p.first[a] > p.first[b + 1] - p.first[b];
+    });
+    color.assign(p.rows, none);
+    std::vector<uint32_t> forbidden; // forbidden[c] == v + 1 while coloring v means c is taken
+    std::vector<uint32_t> around; // how many neighbours of v have each color
+    size_t colors = 0;
+    for (auto v : order) {
+      neighbours(v, [&](uint32_t w) {
+        if (color[w] == none) return;
+        forbidden[color[w]] = v + 1;
+        ++around[color[w]];
+      });
+      neighbours(v, [&](uint32_t w) {
+        if (color[w] == none) return;
+        bool twice = around[color[w]] > 1; // a - v - w - x would be two colored if v took the color of x
+        neighbours(w, [&](uint32_t x) {
+          if (x == v || color[x] == none || forbidden[color[x]] == v + 1) return;
+          bool two_colored = twice;
+          if (!two_colored) neighbours(x, [&](uint32_t y) { // v - w - x - y
+            two_colored |= y != w && color[y] == color[w];
+          });
+          if (two_colored) forbidden[color[x]] = v + 1;
+        });
+      });
+      neighbours(v, [&](uint32_t w) {
+        if (color[w] != none) around[color[w]] = 0;
+      });
+      uint32_t q = 0;
+      while (q < colors && forbidden[q] == v + 1) ++q;
+      if (q == colors) {
+        ++colors;
+        forbidden.push_back(0);
+        around.push_back(0);
+      }
+      color[v] = q;
+    }
+    return colors;
+  }
+
+  /// \brief a reusable plan for computing a sparse Hessian from one \ref bad::tapes::hvp "Hessian-vector product"
+  /// per color.
+  ///
+  /// Built once from a symmetric \ref sparsity_pattern, say from \ref hessian_sparsity, which it completes
+  /// with its transpose and diagonal before \ref star_color "star coloring" it. Each evaluation records and
+  /// sweeps `f`, as for \ref bad::tapes::hvp "hvp", once per color, in the direction of the sum of the inputs
+  /// of that color. \f$H_{ij}\f$ is then read directly from component \f$i\f$ of the product for the color of
+  /// \f$j\f$, unless another input in row \f$i\f$ shares that color, in which case star coloring ensures no
+  /// other input in row \f$j\f$ shares the color of \f$i\f$, and it is component \f$j\f$ of the product for
+  /// that.
+  /// \ingroup tapes_group
+  template <class T>
+  struct sparse_hessian {
+    sparsity_pattern pattern; ///< symmetric, including the diagonal
+    std::vector<uint32_t> color; ///< of each input
+    size_t colors; ///< number of colors
+    std::vector<size_t> from; ///< entry `e` is component `from[e] % n` of the product for color `from[e] / n`
+
+    BAD(hd) explicit
+    sparse_hessian(BAD(noescape) sparsity_pattern const & p) noexcept
+    : colors(0) {
+      assert(p.rows == p.cols);
+      std::vector<std::vector<uint32_t>> adjacent(p.rows);
+      for (size_t r = 0; r < p.rows; ++r)
+        for (size_t e = p.first[r]; e < p.first[r + 1]; ++e) {
+          adjacent[r].push_back(p.columns[e]);
+          adjacent[p.columns[e]].push_back(uint32_t(r));
+        }
+      detail::symmetric_pattern(adjacent, pattern);
+      colors = star_color(pattern, color);
+
+      size_t n = pattern.rows;
+      std::vector<uint32_t> around(colors, 0); // how many inputs in row i have each color
+      std::vector<bool> direct(pattern.nonzeros()); // the color of the column is unique in the row
+      for (size_t i = 0; i < n; ++i) {
+        for (size_t e = pattern.first[i]; e < pattern.first[i + 1]; ++e) ++around[color[pattern.columns[e]]];
+        for (size_t e = pattern.first[i]; e < pattern.first[i + 1]; ++e) direct[e] = around[color[pattern.columns[e]]] == 1;
+        for (size_t e = pattern.first[i]; e < pattern.first[i + 1]; ++e) around[color[pattern.columns[e]]] = 0;
+      }
+      from.resize(pattern.nonzeros());
+      for (size_t i = 0; i < n; ++i)
+        for (size_t e = pattern.first[i]; e < pattern.first[i + 1]; ++e) {
+          size_t j = pattern.columns[e];
+          if (direct[e]) from[e] = color[j] * n + i;
+          else {
+            assert(direct[size_t(std::lower_bound(
+              pattern.columns.begin() + std::ptrdiff_t(pattern.first[j]),
+              pattern.columns.begin() + std::ptrdiff_t(pattern.first[j + 1]),
+              uint32_t(i)
+            ) - pattern.columns.begin())]);
+            from[e] = color[i] * n + j;
+          }
+        }
+    }
+
+    /// number of Hessian-vector products each evaluation takes
+    BAD(hd,pure)
+    size_t sweeps() const noexcept {
+      return colors;
+    }
+
+    /// evaluate the Hessian of `f` at `x`, writing one value per entry of `pattern` to `values`, in the same
+    /// order, and the gradient to `gradient`
+    template <class F>
+    BAD(hd)
+    void operator()(
+      F && f,
+      BAD(noescape) std::vector<T> const & x,
+      BAD(noescape) std::vector<T> & values,
+      BAD(noescape) std::vector<T> & gradient
+    ) const noexcept {
+      size_t n = pattern.rows;
+      assert(x.size() == n);
+      std::vector<T> v(n), product, products(colors * n);
+      gradient.assign(n, T(0));
+      for (size_t c = 0; c < colors; ++c) {
+        for (size_t j = 0; j < n; ++j) v[j] = color[j] == c ? T(1) : T(0);
+        hvp(f, x, v, gradient, product);
+        std::copy(product.begin(), product.end(), products.begin() + std::ptrdiff_t(c * n));
+      }
+      values.resize(pattern.nonzeros());
+      for (size_t e = 0; e < values.size(); ++e) values[e] = products[from[e]];
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef BAD_TAPES_SPILL_HH
+#define BAD_TAPES_SPILL_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bad/attributes.hh"
+#include "bad/memory.hh"
+
+#if __has_include(<fcntl.h>) && __has_include(<unistd.h>)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// \file
+/// \brief out-of-core tapes backed by a memory-mapped scratch file
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+#if defined(BAD_HAS_MMAP) || defined(DOXYGEN)
+  /// \brief the scratch file and resident set shared by every \ref spill_allocator with the same `Tag`.
+  ///
+  /// Slabs are carved out of one unlinked scratch file and mapped shared. Every slab that is mapped and not
+  /// spilled counts as resident: sealed segments, the segments tapes are writing to, and slabs cached by a
+  /// \ref bad::tapes::segment_pool "segment_pool". Whenever that exceeds `budget` bytes, the oldest sealed
+  /// slabs, which a reverse sweep reaches last, are written back and dropped from memory. During a sweep the
+  /// next segment is read ahead, rejoining the resident set if it had been spilled, and while we are over
+  /// budget each segment is dropped again as soon as the sweep is done with it. A tape that fits in the budget
+  /// stays in memory across any number of sweeps.
+  ///
+  /// Only sealed slabs can be spilled, so a segment being written to, or the pool's cache, can still hold us
+  /// over budget once everything sealed is gone. Keep the budget well above the largest segment the tape's
+  /// \ref bad::tapes::segment_growth "segment_growth" allows, and lower the pool's `high_water_bytes` to
+  /// leave more of it to sealed segments.
+  /// \ingroup tapes_group
+  struct spill_arena {
+    /// a sealed slab in memory
+    struct slab {
+      std::byte * memory;
+      size_t size;
+    };
+
+    /// a region of the scratch file
+    struct extent {
+      off_t offset;
+      size_t size;
+    };
+
+    static constexpr size_t default_budget = size_t(256) << 20;
+
+    std::mutex mutex; ///< guards everything below
+    std::string directory; ///< where to create the scratch file. read on first allocation
+    size_t budget; ///< spill sealed segments while more than this many bytes are resident
+    size_t resident; ///< bytes of slabs currently mapped and not spilled
+    size_t evictions; ///< number of times a sealed segment has been written out and dropped
+    int fd; ///< the scratch file, or -1 until first use
+    off_t end; ///< length of the scratch file
+    std::list<slab> sealed; ///< resident sealed slabs, oldest first
+    std::unordered_map<std::byte *, std::list<slab>::iterator> sealed_at; ///< where each is in `sealed`
+    std::unordered_map<std::byte *, size_t> spilled; ///< sealed slabs written out and dropped, with their sizes
+    std::unordered_map<std::byte *, extent> extents; ///< where each live slab lives in the file
+    std::vector<extent> holes; ///< extents released by \ref deallocate
+
+    BAD(hd)
+    spill_arena() noexcept
+    : directory(default_directory())
+    , budget(default_budget)
+    , resident(0)
+    , evictions(0)
+    , fd(-1)
+    , end(0) {}
+
+    BAD(hd)
+    spill_arena(spill_arena const &) = delete;
+
+    BAD(hd)
+    spill_arena & operator = (spill_arena const &) = delete;
+
+    BAD(hd)
+    ~spill_arena() noexcept {
+      if (fd != -1) close(fd);
+    }
+
+    /// `$TMPDIR`, or `/tmp`
+    BAD(hd)
+    static std::string default_directory() noexcept {
+      char const * d = std::getenv("TMPDIR");
+      return d != nullptr && *d != '\0' ? d : "/tmp";
+    }
+
+    /// change the resident budget, spilling immediately if we are now over it
+    BAD(hd,noalias)
+    void set_budget(size_t n) noexcept {
+      std::lock_guard<std::mutex> lock(mutex);
+      budget = n;
+      enforce();
+    }
+
+    /// map `n` bytes of the scratch file. `n` should be a multiple of the page size.
+    ///
+    /// if the scratch file can't be created, grown or mapped, this ends the process through
+    /// \ref bad::memory::allocation_failure "allocation_failure"
+    BAD(hd,nodiscard,returns_nonnull)
+    std::byte * allocate(size_t n) noexcept {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (fd == -1) open_scratch();
+      extent e { end, n };
+      // reuse an exactly matching hole if we have one, the segment pool sends us the same sizes repeatedly
+      auto h = std::find_if(holes.begin(), holes.end(), [n](extent const & x) { return x.size == n; });
+      if (h != holes.end()) {
+        e = *h;
+        *h = holes.back();
+        holes.pop_back();
+      } else {
+        if (ftruncate(fd, end + off_t(n)) != 0) allocation_failure();
+        end += off_t(n);
+      }
+      void * p = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, e.offset);
+      if (p == MAP_FAILED) allocation_failure();
+      auto memory = static_cast<std::byte *>(p);
+      extents.emplace(memory, e);
+      resident += n;
+      enforce();
+      return memory;
+    }
+
+    /// unmap a slab and give its disk space back
+    BAD(hd,noalias)
+    void deallocate(BAD(noescape) std::byte * memory, size_t n) noexcept {
+      std::lock_guard<std::mutex> lock(mutex);
+      forget(memory);
+      resident -= n;
+      munmap(memory, n);
+      auto i = extents.find(memory);
+      assert(i != extents.end());
+      extent e = i->second;
+      extents.erase(i);
+#ifdef FALLOC_FL_PUNCH_HOLE
+      fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, e.offset, off_t(e.size));
+#endif
+      holes.push_back(e);
+    }
+
+    /// a tape is done writing to this slab
+    BAD(hd,noalias)
+    void seal(BAD(noescape) std::byte * memory, size_t n) noexcept {
+      std::lock_guard<std::mutex> lock(mutex);
+      forget(memory);
+      sealed_at.emplace(memory, sealed.insert(sealed.end(), {memory, n}));
+      enforce();
+    }
+
+    /// a tape is done with this slab, or is about to write to it again after a rewind
+    BAD(hd,noalias)
+    void unseal(BAD(noescape) std::byte * memory, BAD(maybe_unused) size_t n) noexcept {
+      std::lock_guard<std::mutex> lock(mutex);
+      forget(memory);
+    }
+
+    /// a sweep is about to read this slab
+    BAD(hd,noalias)
+    void will_need(BAD(noescape) std::byte * memory, size_t n) noexcept {
+#ifdef MADV_WILLNEED
+      madvise(memory, n, MADV_WILLNEED);
+#endif
+      std::lock_guard<std::mutex> lock(mutex);
+      auto i = spilled.find(memory);
+      if (i == spilled.end()) return;
+      // coming back in. newest, so the last to be spilled again by enforce
+      sealed_at.emplace(memory, sealed.insert(sealed.end(), {memory, i->second}));
+      resident += i->second;
+      spilled.erase(i);
+    }
+
+    /// a sweep is done reading this slab. if we're over budget, drop it again
+    BAD(hd,noalias)
+    void swept(BAD(noescape) std::byte * memory, BAD(maybe_unused) size_t n) noexcept {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (resident <= budget) return;
+      auto i = sealed_at.find(memory);
+      if (i == sealed_at.end()) return;
+      slab s = *i->second;
+      sealed.erase(i->second);
+      sealed_at.erase(i);
+      evict(s);
+    }
+
+  private:
+    BAD(hd,noalias)
+    void open_scratch() noexcept {
+      std::string path = directory + "/bad-spill-XXXXXX";
+      fd = mkstemp(path.data());
+      if (fd == -1) allocation_failure();
+      unlink(path.c_str()); // the file lives exactly as long as we hold it open
+    }
+
+    /// stop treating `memory` as sealed, resident or not. it is about to be written to, so it counts as resident
+    BAD(hd,noalias)
+    void forget(std::byte * memory) noexcept {
+      if (auto i = spilled.find(memory); i != spilled.end()) {
+        resident += i->second;
+        spilled.erase(i);
+      } else if (auto j = sealed_at.find(memory); j != sealed_at.end()) {
+        sealed.erase(j->second);
+        sealed_at.erase(j);
+      }
+    }
+
+    /// write a sealed slab, already taken out of `sealed`, out and drop it from memory and from the page cache
+    BAD(hd,noalias)
+    void evict(slab s) noexcept {
+      msync(s.memory, s.size, MS_SYNC);
+      madvise(s.memory, s.size, MADV_DONTNEED);
+#ifdef POSIX_FADV_DONTNEED
+      auto i = extents.find(s.memory);
+      if (i != extents.end()) posix_fadvise(fd, i->second.offset, off_t(s.size), POSIX_FADV_DONTNEED);
+#endif
+      spilled.emplace(s.memory, s.size);
+      resident -= s.size;
+      ++evictions;
+    }
+
+    /// spill the oldest sealed slabs until we fit in the budget
+    BAD(hd,noalias)
+    void enforce() noexcept {
+      while (resident > budget && !sealed.empty()) {
+        slab s = sealed.front();
+        sealed.pop_front();
+        sealed_at.erase(s.memory);
+        evict(s);
+      }
+    }
+  };
+
+  namespace detail {
+    /// the arena for `Tag`, shared by `spill_allocator<T, Tag>` for every `T`, so memory from one can be
+    /// handed back through a rebound copy
+    /// \ingroup tapes_group
+    template <class Tag>
+    BAD(hd)
+    spill_arena & spill_arena_for() noexcept {
+      static spill_arena a;
+      return a;
+    }
+  }
+
+  /// \brief stateless allocator that lets a \ref bad::tapes::tape "tape" grow past physical memory.
+  ///
+  /// Segments live in a memory-mapped scratch file managed by `spill_allocator::arena()`. Sealed segments
+  /// are written out once the resident budget is exceeded, and come back in newest first, with read-ahead,
+  /// as the reverse sweep reaches them.
+  ///
+  /// ~~~{.cc}
+  /// spill_allocator<>::arena().set_budget(size_t(1) << 30);
+  /// tape<double, double*, spill_allocator<>> t;
+  /// ~~~
+  ///
+  /// Allocators with different `Tag`s get separate scratch files and budgets.
+  /// \ingroup tapes_group
+  template <class T = std::byte, class Tag = void>
+  struct spill_allocator {
+    using pointer = T*;
+    using const_pointer = T const *;
+    using void_pointer = void *;
+    using const_void_pointer = void const *;
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+
+    static constexpr size_t page_size = 4096;
+    static constexpr size_t alignment = page_size;
+    static constexpr size_t segment_size = size_t(1) << 20; ///< spill in units of at least a megabyte
+
+    template <class U> struct rebind {
+      using other = spill_allocator<U, Tag>;
+    };
+
+    spill_allocator() = default;
+
+    template <class U>
+    BAD(hd,inline,noalias)
+    constexpr spill_allocator(BAD(noescape) const spill_allocator<U,Tag> &) noexcept {}
+
+    /// the scratch file and budget shared by every allocator with this `Tag`, whatever its `T`
+    BAD(hd)
+    static spill_arena & arena() noexcept {
+      return detail::spill_arena_for<Tag>();
+    }
+
+    /// bytes actually mapped for `n` elements
+    BAD(hd,inline,const) constexpr
+    static size_t mapped_size(size_t n) noexcept {
+      return (n * sizeof(T) + page_size - 1) & ~(page_size - 1);
+    }
+
+    BAD(nodiscard,hd,assume_aligned(alignment),returns_nonnull)
+    T * allocate(size_t n) const noexcept {
+      assert(n < std::numeric_limits<std::size_t>::max() / sizeof(T));
+      return reinterpret_cast<T*>(arena().allocate(mapped_size(n)));
+    }
+
+    /// like \ref bad::memory::huge_page_allocator "huge_page_allocator", there is no unsized deallocate
+    BAD(hd,inline,noalias)
+    void deallocate(BAD(noescape) T * p, size_t n) noexcept {
+      arena().deallocate(reinterpret_cast<std::byte *>(p), mapped_size(n));
+    }
+
+    /// called by the tape when it moves on from a segment
+    BAD(hd,inline,noalias)
+    void seal(BAD(noescape) std::byte * p, size_t n) noexcept {
+      arena().seal(p, mapped_size(n));
+    }
+
+    /// called by the tape when a segment goes back to the pool, or is rewound into
+    BAD(hd,inline,noalias)
+    void unseal(BAD(noescape) std::byte * p, size_t n) noexcept {
+      arena().unseal(p, mapped_size(n));
+    }
+
+    /// called by the sweep before it reaches a segment
+    BAD(hd,inline,noalias)
+    void will_need(BAD(noescape) std::byte * p, size_t n) noexcept {
+      arena().will_need(p, mapped_size(n));
+    }
+
+    /// called by the sweep when it leaves a segment
+    BAD(hd,inline,noalias)
+    void swept(BAD(noescape) std::byte * p, size_t n) noexcept {
+      arena().swept(p, mapped_size(n));
+    }
+
+    template <class U>
+    BAD(hd,inline,const)
+    friend bool operator ==(
+      BAD(maybe_unused) spill_allocator<T,Tag>,
+      BAD(maybe_unused) spill_allocator<U,Tag>
+    ) noexcept {
+      return true;
+    }
+
+    template <class U>
+    BAD(hd,inline,const)
+    friend bool operator !=(
+      BAD(maybe_unused) spill_allocator<T,Tag>,
+      BAD(maybe_unused) spill_allocator<U,Tag>
+    ) noexcept {
+      return false;
+    }
+  };
+#endif
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef BAD_TAPES_STATIC_TAPE_HH
+#define BAD_TAPES_STATIC_TAPE_HH
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "bad/attributes.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief tapes whose sequence of records is part of their type
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  namespace detail {
+    /// holds the `I`th record of a \ref bad::tapes::static_tape "static_tape"
+    /// \ingroup tapes_group
+    template <size_t I, class R>
+    struct static_slot {
+      R record;
+
+      BAD(hd,inline,noalias)
+      static_slot() noexcept : record() {}
+
+      /// records can be neither copied nor moved, so build ours straight from its constructor arguments
+      template <class Args>
+      BAD(hd,inline,noalias)
+      static_slot(std::piecewise_construct_t, Args && args) noexcept
+      : record(std::make_from_tuple<R>(std::forward<Args>(args))) {}
+    };
+
+    /// all the records of a \ref bad::tapes::static_tape "static_tape", oldest first
+    /// \ingroup tapes_group
+    template <class Is, class... Rs>
+    struct static_records;
+
+    template <size_t... Is, class... Rs>
+    struct static_records<std::index_sequence<Is...>, Rs...> : static_slot<Is, Rs>... {
+      BAD(hd,inline,noalias)
+      static_records() noexcept = default;
+
+      template <class... Args>
+      BAD(hd,inline,noalias)
+      static_records(std::piecewise_construct_t, Args && ... args) noexcept
+      : static_slot<Is, Rs>(std::piecewise_construct, std::forward<Args>(args))... {}
+    };
+
+    /// activations owned by the first `n` of `acts`
+    /// \ingroup tapes_group
+    template <size_t n, size_t... acts>
+    BAD(hd,inline,const) constexpr
+    size_t static_offset() noexcept {
+      size_t result = 0, k = 0;
+      ((result += k++ < n ? acts : 0), ...);
+      return result;
+    }
+  }
+
+  /// \brief a tape for a computation graph whose shape is known at compile time.
+  ///
+  /// `Rs` are the records, oldest first, each a \ref static_record over the same `T` and `Act`. They live
+  /// side by side inside the tape object rather than in segments, so there are no \ref bad::tapes::detail::link "links",
+  /// no terminator, and nothing to allocate. \ref sweep calls each record's `prop` directly, newest first,
+  /// so the whole reverse sweep inlines into straight-line code.
+  ///
+  /// ~~~{.cc}
+  /// static_tape<var, var, mul> t(std::piecewise_construct, std::tuple(), std::tuple(), std::tuple(0, 3., 1, 4.));
+  /// auto g = t.backprop(2); // g[0] == 4, g[1] == 3
+  /// ~~~
+  ///
+  /// Records with default constructors can be left out, as in `static_tape<var, var>()`.
+  /// \ingroup tapes_group
+  template <class... Rs>
+  struct static_tape {
+    static_assert(sizeof...(Rs) > 0, "static_tape: no records");
+
+    using first_type = std::tuple_element_t<0, std::tuple<Rs...>>;
+    using act_t = typename first_type::act_t;
+    using adjoint_type = std::remove_pointer_t<act_t>; ///< what \ref backprop stores per activation
+
+    static_assert((std::is_same_v<typename Rs::act_t, act_t> && ...), "static_tape: records disagree about their activation type");
+
+    static constexpr size_t size = sizeof...(Rs); ///< number of records
+    static constexpr size_t activations = (size_t(0) + ... + Rs::acts); ///< number of activations the records own
+
+    /// first activation owned by record `I`
+    template <size_t I>
+    static constexpr size_t offset = detail::static_offset<I, Rs::acts...>();
+
+    /// type of record `I`
+    template <size_t I>
+    using record_type = std::tuple_element_t<I, std::tuple<Rs...>>;
+
+    detail::static_records<std::index_sequence_for<Rs...>, Rs...> records;
+
+    BAD(hd,inline,noalias)
+    static_tape() noexcept = default;
+
+    /// construct record `I` from the elements of the `I`th tuple in `args`
+    template <class... Args>
+    BAD(hd,inline,noalias)
+    static_tape(std::piecewise_construct_t, Args && ... args) noexcept
+    : records(std::piecewise_construct, std::forward<Args>(args)...) {
+      static_assert(sizeof...(Args) == sizeof...(Rs), "static_tape: need one tuple of arguments per record");
+    }
+
+    BAD(hd)
+    static_tape(static_tape const &) = delete;
+
+    BAD(hd)
+    static_tape & operator = (static_tape const &) = delete;
+
+    template <size_t I>
+    BAD(hd,inline,pure)
+    record_type<I> & get() noexcept {
+      return static_cast<detail::static_slot<I, record_type<I>> &>(records).record;
+    }
+
+    template <size_t I>
+    BAD(hd,inline,pure)
+    record_type<I> const & get() const noexcept {
+      return static_cast<detail::static_slot<I, record_type<I>> const &>(records).record;
+    }
+
+    /// propagate adjoints from `act` backwards through every record
+    BAD(hd,flatten)
+    void sweep(act_t act) const noexcept {
+      sweep(act, std::make_index_sequence<size>());
+    }
+
+    /// reset `result` to hold one zeroed adjoint per activation, seed `output`, and sweep
+    BAD(hd,flatten)
+    void backprop(
+      BAD(noescape) adjoints<adjoint_type> & result,
+      size_t output,
+      adjoint_type seed = adjoint_type(1)
+    ) const noexcept {
+      static_assert(std::is_pointer_v<act_t>, "managed backprop requires a pointer activation type");
+      assert(output < activations);
+      result.reset(activations);
+      result[output] = seed;
+      sweep(result.data());
+    }
+
+    /// sweep into a freshly allocated buffer, seeding activation `output` with `seed`
+    BAD(hd,nodiscard)
+    adjoints<adjoint_type> backprop(size_t output, adjoint_type seed = adjoint_type(1)) const noexcept {
+      adjoints<adjoint_type> result;
+      backprop(result, output, seed);
+      return result;
+    }
+
+  private:
+    template <size_t... Is>
+    BAD(hd,inline,flatten)
+    void sweep(act_t act, std::index_sequence<Is...>) const noexcept {
+      // the comma fold runs left to right, so count down from the newest record
+      (step<size - 1 - Is>(act), ...);
+    }
+
+    template <size_t I>
+    BAD(hd,inline,flatten)
+    void step(act_t act) const noexcept {
+      size_t i = offset<I>;
+      get<I>().prop(act, i);
+    }
+  };
+}
+
+#endif
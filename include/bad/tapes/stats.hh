@@ -0,0 +1,188 @@
+#ifndef BAD_TAPES_STATS_HH
+#define BAD_TAPES_STATS_HH
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "bad/attributes.hh"
+#include "bad/types.hh"
+#include "bad/tapes/tape.hh"
+
+/// \file
+/// \brief where a tape's memory and sweep time go
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  namespace detail {
+    /// a cheap timestamp. cycles of the timestamp counter where we have one, nanoseconds otherwise
+    /// \ingroup tapes_group
+    BAD(hd,inline)
+    uint64_t ticks() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+      return __rdtsc();
+#else
+      return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+      ).count());
+#endif
+    }
+  }
+
+  /// totals for one record type
+  /// \ingroup tapes_group
+  struct record_stats {
+    std::string name; ///< demangled type name
+    size_t count; ///< number of records
+    size_t bytes; ///< slab bytes they occupy, alignment padding included
+    size_t activations; ///< activations they own
+    uint64_t ticks; ///< time spent in their `propagate` during a \ref profile, in \ref bad::tapes::detail::ticks "ticks"
+  };
+
+  /// \brief a breakdown of a tape by record type, plus how well its segments are filled.
+  ///
+  /// Produced by \ref stats, or by \ref profile, which also times a sweep.
+  /// \ingroup tapes_group
+  struct tape_stats {
+    std::vector<record_stats> records; ///< one entry per record type, most bytes first
+    size_t segments = 0; ///< number of segments
+    size_t slab_bytes = 0; ///< total size of the slabs
+    size_t record_bytes = 0; ///< bytes occupied by records
+    size_t boundary_bytes = 0; ///< bytes reserved at the top of each segment for its link or terminator
+    size_t free_bytes = 0; ///< bytes left unused below the newest record of each segment
+    uint64_t ticks = 0; ///< duration of the whole profiled sweep
+
+    /// fraction of the slabs not holding records
+    BAD(hd,pure)
+    double fragmentation() const noexcept {
+      return slab_bytes == 0 ? 0 : 1 - double(record_bytes) / double(slab_bytes);
+    }
+
+    BAD(hd)
+    friend std::ostream & operator << (BAD(noescape) std::ostream & os, BAD(noescape) tape_stats const & s) noexcept {
+      os << s.segments << " segments, " << s.slab_bytes << " bytes, "
+         << std::fixed << std::setprecision(1) << 100 * s.fragmentation() << "% unused ("
+         << s.free_bytes << " free, " << s.boundary_bytes << " in links)\n";
+      for (auto const & r : s.records) {
+        os << "  " << r.name << ": " << r.count << " records, " << r.bytes << " bytes, " << r.activations << " activations";
+        if (s.ticks != 0) os << ", " << r.ticks << " ticks (" << 100 * double(r.ticks) / double(s.ticks) << "%)";
+        os << "\n";
+      }
+      return os;
+    }
+  };
+
+  namespace detail {
+    /// accumulates \ref tape_stats for each record type by dynamic type
+    /// \ingroup tapes_group
+    struct stats_builder {
+      tape_stats result;
+      std::unordered_map<std::type_index, size_t> index;
+
+      template <class T, class Act, class Allocator>
+      BAD(hd)
+      record_stats & entry(BAD(noescape) abstract_record<T, Act, Allocator> const * p) noexcept {
+        auto [it, fresh] = index.emplace(std::type_index(typeid(*p)), result.records.size());
+        if (fresh) result.records.push_back({ demangle(typeid(*p).name()), 0, 0, 0, 0 });
+        return result.records[it->second];
+      }
+
+      template <class T, class Act, class Allocator>
+      BAD(hd)
+      void add(BAD(noescape) tape<T, Act, Allocator> const & t) noexcept {
+        using abstract_record_type = abstract_record<T, Act, Allocator>;
+        auto & r = result;
+        for (auto s = t.segment.memory ? &t.segment : nullptr; s != nullptr; s = s->next_segment()) {
+          ++r.segments;
+          r.slab_bytes += s->size;
+          r.boundary_bytes += s->boundary_size();
+          r.free_bytes += size_t(reinterpret_cast<std::byte const *>(s->current) - s->memory);
+          for (abstract_record_type const * p = s->current, * b = s->boundary(); p != b;) {
+            abstract_record_type const * q = p->next();
+            size_t bytes = size_t(reinterpret_cast<std::byte const *>(q) - reinterpret_cast<std::byte const *>(p));
+            auto & e = entry(p);
+            ++e.count;
+            e.bytes += bytes;
+            e.activations += p->activations();
+            r.record_bytes += bytes;
+            p = q;
+          }
+        }
+      }
+
+      BAD(hd)
+      tape_stats finish() noexcept {
+        std::stable_sort(result.records.begin(), result.records.end(), [](auto const & a, auto const & b) {
+          return a.bytes > b.bytes;
+        });
+        return std::move(result);
+      }
+    };
+
+    /// sweep strategy that charges the time spent in each step to the record's type
+    /// \ingroup tapes_group
+    template <class Dispatch>
+    struct timed_dispatch {
+      Dispatch const & step;
+      stats_builder & builder;
+
+      template <class T, class Act, class Allocator>
+      BAD(hd,inline)
+      abstract_record<T,Act,Allocator> const * operator()(
+        BAD(noescape) abstract_record<T,Act,Allocator> const * p,
+        Act act,
+        BAD(noescape) size_t & i
+      ) const noexcept {
+        auto & e = builder.entry(p); // look this up outside of the timed region
+        uint64_t start = ticks();
+        auto q = step(p, act, i);
+        e.ticks += ticks() - start;
+        return q;
+      }
+    };
+  }
+
+  /// count, size, and activations of each type of record on `t`, and how full its segments are
+  /// \ingroup tapes_group
+  template <class T, class Act, class Allocator>
+  BAD(hd,nodiscard)
+  tape_stats stats(BAD(noescape) tape<T, Act, Allocator> const & t) noexcept {
+    detail::stats_builder b;
+    b.add(t);
+    return b.finish();
+  }
+
+  /// \ref stats, plus a reverse sweep over `act` that records how long each type of record spends in `propagate`.
+  ///
+  /// Timing every step has overhead of its own, so compare types against one another rather than against
+  /// an untimed sweep.
+  /// \ingroup tapes_group
+  template <class T, class Act, class Allocator, class Dispatch = virtual_dispatch>
+  BAD(hd,nodiscard)
+  tape_stats profile(
+    BAD(noescape) tape<T, Act, Allocator> const & t,
+    Act act,
+    BAD(noescape) Dispatch const & step = Dispatch()
+  ) noexcept {
+    detail::stats_builder b;
+    b.add(t);
+    uint64_t start = detail::ticks();
+    t.sweep(act, detail::timed_dispatch<Dispatch> { step, b });
+    b.result.ticks = detail::ticks() - start;
+    return b.finish();
+  }
+}
+
+#endif
@@ -0,0 +1,1643 @@
+#ifndef BAD_TAPES_TAPE_HH
+#define BAD_TAPES_TAPE_HH
+
+#include <tuple>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <type_traits>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include "bad/types.hh"
+#include "bad/memory.hh"
+#include "bad/tapes/pool.hh"
+#include "bad/tapes/trace.hh"
+
+/// \file
+/// \brief tapes, records and the reverse sweep
+/// \author Edward Kmett
+
+namespace bad::tapes {
+  static constexpr size_t no_index = static_cast<size_t>(-1);
+
+  /// \brief Tape sensitivities. Constructed with tape::push.
+  ///
+  /// Describes how to push information backwards through your activations
+  /// by using the information stored in the \ref bad::tapes::tape "tape".
+  /// \ingroup tapes_group
+#ifdef DOXYGEN
+  template <class T, class Act, class Allocator>
+#else
+  template <class T, class Act = T*, class Allocator = default_allocator>
+#endif
+  struct abstract_record;
+
+  /// Wengert list
+  /// \ingroup tapes_group
+  template <class T, class Act = T*,class Allocator = default_allocator>
+  struct tape;
+
+  namespace detail {
+
+    /// segment size used unless the allocator asks for something else
+    /// \ingroup tapes_group
+    template <class Allocator, class = void>
+    struct segment_size_ : constant<size_t(65536)> {};
+
+    /// allocators with a `segment_size`, like \ref bad::memory::huge_page_allocator "huge_page_allocator",
+    /// get segments that match it
+    /// \ingroup tapes_group
+    template <class Allocator>
+    struct segment_size_<Allocator, std::void_t<decltype(Allocator::segment_size)>>
+    : constant<size_t(Allocator::segment_size)> {};
+
+    /// records are aligned to \ref bad::memory::record_alignment "record_alignment" unless the allocator asks for more
+    /// \ingroup tapes_group
+    template <class Allocator, class = void>
+    struct record_alignment_ : constant<record_alignment> {};
+
+    /// allocators with a `record_alignment`, like `aligned_allocator<std::byte, 64>`, align every record on the
+    /// tape to it, so records can carry payloads for aligned wide vector loads
+    /// \ingroup tapes_group
+    template <class Allocator>
+    struct record_alignment_<Allocator, std::void_t<decltype(Allocator::record_alignment)>>
+    : constant<std::max(record_alignment, size_t(Allocator::record_alignment))> {};
+
+    /// round `i` up to a multiple of `Alignment`, a power of two
+    /// \ingroup tapes_group
+    template <size_t Alignment = record_alignment>
+    BAD(hd,inline,const) constexpr
+    size_t pad_to_alignment(size_t i) noexcept {
+      static_assert((Alignment & (Alignment - 1)) == 0, "alignment must be a power of two");
+      return (i + Alignment - 1) & ~(Alignment - 1);
+    }
+
+    /// detects the optional `seal(memory, size)` hook, see \ref seal
+    /// \ingroup tapes_group
+    template <class Allocator, class = void>
+    struct has_seal_ : std::false_type {};
+
+    template <class Allocator>
+    struct has_seal_<Allocator, std::void_t<decltype(std::declval<Allocator &>().seal(std::declval<std::byte *>(), size_t()))>>
+    : std::true_type {};
+
+    /// detects the optional `unseal(memory, size)` hook, see \ref unseal
+    /// \ingroup tapes_group
+    template <class Allocator, class = void>
+    struct has_unseal_ : std::false_type {};
+
+    template <class Allocator>
+    struct has_unseal_<Allocator, std::void_t<decltype(std::declval<Allocator &>().unseal(std::declval<std::byte *>(), size_t()))>>
+    : std::true_type {};
+
+    /// detects the optional `will_need(memory, size)` and `swept(memory, size)` sweep hooks
+    /// \ingroup tapes_group
+    template <class Allocator, class = void>
+    struct has_sweep_hooks_ : std::false_type {};
+
+    template <class Allocator>
+    struct has_sweep_hooks_<Allocator, std::void_t<
+      decltype(std::declval<Allocator &>().will_need(std::declval<std::byte *>(), size_t())),
+      decltype(std::declval<Allocator &>().swept(std::declval<std::byte *>(), size_t()))
+    >> : std::true_type {};
+
+    /// tell the allocator that a segment is full and will not be written again until it is swept or freed.
+    /// a no-op unless the allocator has a `seal` member.
+    /// \ingroup tapes_group
+    template <class Allocator>
+    BAD(hd,inline)
+    void seal(BAD(maybe_unused) std::byte * memory, BAD(maybe_unused) size_t size) noexcept {
+      if constexpr (has_seal_<Allocator>::value) Allocator().seal(memory, size);
+    }
+
+    /// tell the allocator that a segment is no longer sealed: it is going back to the pool, or a rewind has
+    /// uncovered it and the tape will record into it again. a no-op unless the allocator has an `unseal` member.
+    /// \ingroup tapes_group
+    template <class Allocator>
+    BAD(hd,inline)
+    void unseal(BAD(maybe_unused) std::byte * memory, BAD(maybe_unused) size_t size) noexcept {
+      if constexpr (has_unseal_<Allocator>::value) Allocator().unseal(memory, size);
+    }
+
+    /// tell the allocator the sweep is about to read a segment
+    /// \ingroup tapes_group
+    template <class Allocator>
+    BAD(hd,inline)
+    void will_need(BAD(maybe_unused) std::byte * memory, BAD(maybe_unused) size_t size) noexcept {
+      if constexpr (has_sweep_hooks_<Allocator>::value) Allocator().will_need(memory, size);
+    }
+
+    /// tell the allocator the sweep is done reading a segment
+    /// \ingroup tapes_group
+    template <class Allocator>
+    BAD(hd,inline)
+    void swept(BAD(maybe_unused) std::byte * memory, BAD(maybe_unused) size_t size) noexcept {
+      if constexpr (has_sweep_hooks_<Allocator>::value) Allocator().swept(memory, size);
+    }
+
+    /// bytes of slabs held by live segments of every tape in the process, see \ref bad::tapes::resident_tape_bytes
+    /// \ingroup tapes_group
+    inline std::atomic<size_t> resident_tape_bytes { 0 };
+
+    /// how far ahead of the record being propagated a sweep asks for the tape to be brought into cache
+    /// \ingroup tapes_group
+    inline constexpr size_t sweep_prefetch_distance = 32 * cache_line_size;
+
+    /// hint that `p` will be read soon. never faults, so it is safe past the end of a slab
+    /// \ingroup tapes_group
+    BAD(hd,inline)
+    void prefetch(BAD(maybe_unused) void const * p) noexcept {
+      __builtin_prefetch(p, 0, 3);
+    }
+
+    /// holds several \ref abstract_record entries in a slab of aligned memory
+    /// \ingroup tapes_group
+    template <class T, class Act = T*, class Allocator = default_allocator>
+    struct segment final {
+
+      using abstract_record_type = abstract_record<T,Act,Allocator>;
+
+      static constexpr size_t minimum_size = segment_size_<Allocator>::value;
+
+      static constexpr size_t alignment = record_alignment_<Allocator>::value; ///< of every record in the slab
+
+      using pool_type = segment_pool<Allocator>;
+
+      abstract_record_type * current; ///< current abstract_record pointer. bump allocated downward
+
+      std::byte * memory; ///< the slab of memory owned by this segment, drawn from the thread's \ref bad::tapes::segment_pool "segment_pool"
+
+      size_t size; ///< size of the slab in bytes
+
+      bool trivial; ///< every record in this segment is trivially destructible, so we can free it without visiting them
+
+      BAD(hd)
+      segment(const segment<T, Act, Allocator> &) = delete;
+
+      BAD(hd)
+      segment<T, Act, Allocator> & operator=(segment<T, Act, Allocator> const &) = delete;
+
+      BAD(reinitializes,hd,noalias)
+      segment<T, Act, Allocator> & operator=(segment<T, Act, Allocator> && rhs) noexcept;
+
+    private:
+      BAD(hd,inline) explicit segment(typename pool_type::slab slab) noexcept
+      : current(reinterpret_cast<abstract_record_type*>(slab.memory + slab.size))
+      , memory(slab.memory)
+      , size(slab.size)
+      , trivial(true) {
+      }
+
+      BAD(hd,inline)
+      static typename pool_type::slab acquire(size_t n) noexcept {
+        n = pad_to_alignment<alignment>(n);
+        std::byte * memory = pool_type::local().acquire(n);
+        resident_tape_bytes.fetch_add(n, std::memory_order_relaxed);
+        return { memory, n };
+      }
+
+      /// hand the slab back to the pool, leaving this segment empty
+      BAD(hd,inline)
+      void release() noexcept {
+        if (memory != nullptr) {
+          unseal<Allocator>(memory, size);
+          resident_tape_bytes.fetch_sub(size, std::memory_order_relaxed);
+          pool_type::local().release(memory, size);
+        }
+        current = nullptr;
+        memory = nullptr;
+        size = 0;
+        trivial = true;
+      }
+
+    public:
+      BAD(hd,inline,noalias) constexpr
+      segment() noexcept : current(nullptr), memory(nullptr), size(0), trivial(true) {};
+
+      BAD(hd,noalias)
+      segment(size_t n) noexcept;
+
+      BAD(hd,noalias)
+      segment(size_t n, segment<T, Act, Allocator> && next) noexcept;
+
+      BAD(hd,noalias)
+      segment(abstract_record_type * current, std::byte * memory, size_t size, bool trivial = false) noexcept
+      : current(current), memory(memory), size(size), trivial(trivial) {}
+
+      BAD(hd,inline,noalias)
+      segment(segment && rhs) noexcept
+      : current(std::move(rhs.current))
+      , memory(std::move(rhs.memory))
+      , size(std::move(rhs.size))
+      , trivial(rhs.trivial) {
+        rhs.current = nullptr;
+        rhs.memory = nullptr;
+        rhs.size = 0;
+        rhs.trivial = true;
+      }
+
+      BAD(hd,noalias)
+      ~segment() noexcept;
+
+      /// destroy records from `current` up to, but not including, `stop`, which must live in this segment
+      BAD(hd,noalias)
+      void unwind(abstract_record_type * stop) noexcept;
+
+      /// destroy every record in this segment, return the slab, and become the segment we linked to, if any
+      BAD(hd,noalias)
+      void pop() noexcept;
+
+      /// destroy every record and every older segment, but keep this slab, leaving only a terminator
+      BAD(hd,noalias)
+      void reset() noexcept;
+
+      /// bytes reserved at the top of every segment for its \ref link or \ref terminator
+      BAD(hd,const)
+      static constexpr size_t boundary_size() noexcept;
+
+      /// the \ref link or \ref terminator, which always lives in the top `boundary_size()` bytes of the slab
+      BAD(hd,inline,pure,assume_aligned(record_alignment))
+      abstract_record_type * boundary() const noexcept {
+        return reinterpret_cast<abstract_record_type *>(memory + size - boundary_size());
+      }
+
+      /// the segment we link to, if any
+      BAD(hd,pure)
+      segment const * next_segment() const noexcept;
+
+      /// the segment we link to, if any
+      BAD(hd,pure)
+      segment * next_segment() noexcept {
+        return const_cast<segment *>(static_cast<segment const *>(this)->next_segment());
+      }
+
+      /// replace the terminator at the end of our chain with a link to `older`, taking ownership of it
+      BAD(hd,noalias)
+      void append(segment && older) noexcept;
+
+    private:
+      /// construct the boundary record `B` in the top slot of a fresh slab
+      template <class B, class... Args>
+      BAD(hd,inline)
+      void place_boundary(Args && ... args) noexcept {
+        current = reinterpret_cast<abstract_record_type *>(
+          reinterpret_cast<std::byte *>(boundary()) + pad_to_alignment<alignment>(sizeof(B))
+        );
+        BAD(maybe_unused) auto p = new(*this) B(std::forward<Args>(args)...);
+        assert(static_cast<abstract_record_type *>(p) == boundary());
+      }
+    };
+
+    /// \ingroup tapes_group
+    template <class T, class Act, class Allocator>
+    BAD(hd,inline,noalias) void swap(
+      BAD(noescape) segment<T, Act, Allocator> & a,
+      BAD(noescape) segment<T, Act, Allocator> & b
+    ) noexcept {
+      using std::swap;
+      swap(a.current, b.current);
+      swap(a.memory, b.memory);
+      swap(a.size, b.size);
+      swap(a.trivial, b.trivial);
+    }
+
+    /// hands out record tags. 0 is reserved for records that only know how to dispatch virtually.
+    /// \ingroup tapes_group
+    BAD(hd,inline)
+    uint32_t fresh_record_tag() noexcept {
+      static std::atomic<uint32_t> next_tag(1);
+      return next_tag.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// a small process-wide id for the record type `B`, stored in each `B` on the tape
+    /// \ingroup tapes_group
+    template <class B>
+    BAD(hd,inline)
+    uint32_t record_tag() noexcept {
+      static const uint32_t tag = fresh_record_tag();
+      return tag;
+    }
+
+  /// inherits from \ref abstract_record but doxygen is broken and can't figure this out.
+  /// \ingroup tapes_group
+#ifdef DOXYGEN
+    template <class T, class Act, class Allocator>
+    struct link final : abstract_record<T, Act, Allocator> {};
+#else
+    template <class T, class Act = T*, class Allocator = default_allocator>
+    struct link;
+#endif
+  }
+
+  /// \ingroup tapes_group
+  template <class T, class Act, class Allocator>
+  struct alignas(detail::record_alignment_<Allocator>::value) abstract_record {
+    using tape_t = tape<T,Act,Allocator>;
+    using act_t = Act;
+    using abstract_record_type = abstract_record<T, Act, Allocator>;
+
+    /// every record on a tape with this `Allocator` starts at a multiple of this, and its size is padded
+    /// out to one. see \ref bad::tapes::detail::record_alignment_ "record_alignment_"
+    static constexpr size_t alignment = detail::record_alignment_<Allocator>::value;
+
+    /// \ref bad::tapes::detail::record_tag "record_tag" of the most derived record type, or 0.
+    ///
+    /// lets a \ref bad::tapes::dispatch "dispatch" recognize the record without going through the vtable.
+    uint32_t tag;
+
+    BAD(hd,inline,noalias) constexpr
+    abstract_record() noexcept : tag(0) {}
+
+    // disable copy construction
+    BAD(hd)
+    abstract_record(const abstract_record &) = delete;
+
+    BAD(hd)
+    abstract_record & operator=(const abstract_record &) = delete;
+
+    BAD(hd)
+    virtual abstract_record * next() noexcept = 0;
+
+    BAD(hd)
+    virtual abstract_record const * next() const noexcept = 0;
+
+    /// run the destructor of the most derived type.
+    ///
+    /// records are never deleted through a base pointer, so `~abstract_record` isn't virtual. that way
+    /// record types that own nothing stay trivially destructible, and segments full of them can be
+    /// freed without visiting each one.
+    BAD(hd)
+    virtual void destroy() noexcept = 0;
+
+    /// serialize debugging information
+    BAD(hd)
+    virtual void what(BAD(noescape) std::ostream &) const noexcept = 0;
+
+    BAD(hd)
+    virtual size_t activations() const noexcept { return 0; }
+
+    /// push sensitivities backwards through this record.
+    ///
+    /// `i` counts down from \ref bad::tapes::tape::activations "tape::activations" over the course of a sweep.
+    /// a record pushed when the tape held `k` activations owns `act[k] .. act[k+activations()-1]`,
+    /// and on entry to `B::prop` for a \ref bad::tapes::record "record" `i == k`.
+    BAD(hd,assume_aligned(record_alignment))
+    virtual abstract_record const * propagate(Act act, BAD(noescape) size_t & i) const noexcept = 0;
+
+    /// append every activation `prop` adds into to `out`, given that this record owns the activations
+    /// starting at `i`. records always read their own activations.
+    ///
+    /// returns false if the record can't say, in which case \ref bad::tapes::parallel_sweep "parallel sweeps"
+    /// have to treat it as a barrier.
+    BAD(hd)
+    virtual bool inputs(
+      BAD(maybe_unused) size_t i,
+      BAD(maybe_unused,noescape) std::vector<size_t> & out
+    ) const noexcept {
+      return false;
+    }
+
+    /// recompute the primal values of the activations this record owns, starting at `i`, from the values
+    /// of its inputs in `values`, and refresh whatever it saved for `prop` to match.
+    ///
+    /// records that introduce inputs leave their values alone. returns false if the record can't be
+    /// replayed, in which case a \ref bad::tapes::replay_plan "replay_plan" stops there.
+    BAD(hd)
+    virtual bool replay(
+      BAD(maybe_unused) T * values,
+      BAD(maybe_unused) size_t i
+    ) noexcept {
+      return false;
+    }
+
+    BAD(hd,assume_aligned(record_alignment),noalias)
+    virtual detail::link<T,Act,Allocator> const * as_link() const noexcept { return nullptr; }
+
+    BAD(hd,assume_aligned(record_alignment),noalias)
+    virtual detail::link<T,Act,Allocator> * as_link() noexcept { return nullptr; }
+
+    /// unlike usual, the result can be reached through the \ref bad::tapes::tape "tape". calls
+    /// \ref bad::memory::allocation_failure "allocation_failure" if its budget won't let the tape grow.
+    BAD(maybe_unused,hd,alloc_size(1),assume_aligned(record_alignment))
+    void * operator new(size_t, BAD(noescape) tape_t &) noexcept;
+
+    /// as above, but returns nullptr if the tape's budget won't let it grow
+    BAD(maybe_unused,hd,alloc_size(1),assume_aligned(record_alignment))
+    void * operator new(size_t, BAD(noescape) tape_t &, std::nothrow_t const &) noexcept;
+
+    /// used internally. returns nullptr if the \ref bad::tapes::detail::segment "segment" is out of room.
+    BAD(maybe_unused,hd,alloc_size(1),assume_aligned(record_alignment))
+    void * operator new(size_t, BAD(noescape) detail::segment<T, Act, Allocator> &) noexcept;
+
+    BAD(hd)
+    void operator delete(BAD(maybe_unused) void * data) noexcept {}
+
+    BAD(hd) void * operator new  (size_t) = delete;
+    BAD(hd) void * operator new  (size_t, void *) noexcept = delete;
+    BAD(hd) void * operator new  (size_t, const std::nothrow_t &) = delete;
+    BAD(hd) void * operator new  (size_t, const std::align_val_t &, const std::nothrow_t &) = delete;
+    BAD(hd) void * operator new[](size_t) = delete;
+    BAD(hd) void * operator new[](size_t, void *) noexcept = delete;
+    BAD(hd) void * operator new[](size_t, const std::nothrow_t &) = delete;
+    BAD(hd) void * operator new[](size_t, const std::align_val_t &, const std::nothrow_t &) = delete;
+    BAD(hd) void operator delete[](void *) noexcept = delete;
+    BAD(hd) void operator delete[](void *, size_t) noexcept = delete;
+    BAD(hd) void operator delete[](void *, std::align_val_t) noexcept = delete;
+    BAD(hd) void operator delete[](void *, size_t, std::align_val_t) noexcept = delete;
+
+  protected:
+    BAD(hd)
+    ~abstract_record() noexcept = default;
+  };
+
+  /// \ingroup tapes_group
+  template <class T, class Act, class Allocator>
+  inline std::ostream & operator << (
+    std::ostream & os,
+    BAD(noescape) const abstract_record<T, Act, Allocator> & d
+  ) noexcept {
+    d.what(os);
+    return os;
+  }
+
+  template <class T, class Act, class Allocator>
+  void * abstract_record<T,Act,Allocator>::operator new(size_t t, BAD(noescape) detail::segment<T, Act, Allocator> & segment) noexcept {
+    if (segment.memory == nullptr) return nullptr;
+    std::byte * p BAD(align_value(record_alignment)) = reinterpret_cast<std::byte *>(segment.current);
+    t = detail::pad_to_alignment<alignment>(t);
+    if (p - segment.memory < ptrdiff_t(t)) return nullptr;
+    p -= t;
+    segment.current = reinterpret_cast<abstract_record_type*>(p);
+    // requires c++20
+    // return std::assume_aligned<record_alignment>(static_cast<void *>(p));
+    return static_cast<void *>(p);
+  }
+
+  namespace detail {
+  
+    template <class T, class Act, class Allocator>
+    segment<T, Act, Allocator>::~segment() noexcept {
+      // this avoids building up a stack frame for each segment
+      while (memory != nullptr) pop();
+    }
+
+    template <class T, class Act, class Allocator>
+    void segment<T, Act, Allocator>::unwind(abstract_record<T, Act, Allocator> * stop) noexcept {
+      if (!trivial) {
+        abstract_record<T, Act, Allocator> * p BAD(align_value(record_alignment)) = current;
+        while (p != stop) {
+          assert(p != nullptr && p->as_link() == nullptr);
+          abstract_record<T, Act, Allocator> * np BAD(align_value(record_alignment)) = p->next();
+          p->destroy();
+          p = np;
+        }
+      }
+      current = stop;
+    }
+
+    template <class T, class Act, class Allocator>
+    void segment<T, Act, Allocator>::pop() noexcept {
+      abstract_record<T, Act, Allocator> * b BAD(align_value(record_alignment)) = boundary();
+      unwind(b);
+      link<T, Act, Allocator> * link BAD(align_value(record_alignment)) = b->as_link();
+      if (link) {
+        // we're going to become it
+        segment<T, Act, Allocator> temp = std::move(link->segment);
+        b->destroy();
+        release();
+        swap(*this,temp);
+        return;
+      }
+      b->destroy();
+      release();
+    }
+
+    template <class T, class Act, class Allocator>
+    inline segment<T, Act, Allocator> & segment<T, Act, Allocator>::operator=(
+      segment<T, Act, Allocator> && rhs
+    ) noexcept {
+      using std::swap;
+      swap(*this,rhs);
+      return *this;
+    }
+  
+    /// the last segment in a tape. this is the only thing abstract_record that should
+    /// return nullptr from next() and propagate()
+    /// \ingroup tapes_group
+#ifdef DOXYGEN
+    template <class T, class Act, class Allocator>
+#else
+    template <class T, class Act = T*, class Allocator = default_allocator>
+#endif
+    struct terminator final : abstract_record<T, Act, Allocator> {
+      using abstract_record_type = abstract_record<T, Act, Allocator>;
+  
+      BAD(hd,inline,const)
+      abstract_record_type * next() noexcept override {
+        return nullptr;
+      }
+  
+      BAD(hd,inline,const)
+      abstract_record_type const * next() const noexcept override {
+        return nullptr;
+      }
+  
+      BAD(hd)
+      void what(BAD(noescape) std::ostream & os) const noexcept override {
+        os << "terminator";
+      }
+
+      BAD(hd,inline)
+      void destroy() noexcept override {
+        this->~terminator();
+      }
+  
+      BAD(hd,inline,const)
+      abstract_record_type const * propagate(
+        BAD(maybe_unused) Act act,
+        BAD(maybe_unused,noescape) size_t &
+      ) const noexcept override {
+        return nullptr;
+      }
+    };
+  
+    template <class T, class Act, class Allocator> segment<T, Act, Allocator>::segment(size_t n) noexcept
+    : segment(acquire(n)) {
+      place_boundary<terminator<T, Act, Allocator>>();
+      // done. the terminator is reachable through through current.
+    }
+  
+    /// link to the next \ref segment
+    /// \ingroup tapes_group
+    template <class T, class Act, class Allocator>
+    struct link final : abstract_record<T, Act, Allocator> {
+      using abstract_record_type = abstract_record<T, Act, Allocator>;
+  
+      BAD(hd)
+      link() = delete;
+  
+      BAD(hd,noalias)
+      link(segment<T, Act, Allocator> && segment) noexcept
+      : segment(std::move(segment)) {}
+  
+      BAD(hd,inline,pure)
+      abstract_record_type * next() noexcept override {
+        return segment.current;
+      }
+  
+      BAD(hd,inline,pure)
+      abstract_record_type const * next() const noexcept override {
+        return segment.current;
+      }
+  
+      BAD(hd)
+      void what(BAD(noescape) std::ostream & os) const noexcept override {
+        os << "link";
+      }
+
+      BAD(hd,inline)
+      void destroy() noexcept override {
+        this->~link();
+      }
+  
+      BAD(hd,inline,pure)
+      abstract_record_type const * propagate(
+        BAD(maybe_unused) Act act,
+        BAD(maybe_unused,noescape) size_t &
+      ) const noexcept override {
+        return segment.current;
+      }
+  
+      BAD(hd,inline,const)
+      link<T, Act, Allocator> * as_link() noexcept override {
+        return this;
+      }
+  
+      BAD(hd,inline,const)
+      link<T, Act, Allocator> const * as_link() const noexcept override {
+        return this;
+      }
+  
+      segment<T, Act, Allocator> segment;
+    };
+  
+    template <class T, class Act, class Allocator>
+    segment<T, Act, Allocator>::segment(size_t n, segment<T,Act,Allocator> && next) noexcept
+    : segment(acquire(n)) {
+      if (next.memory != nullptr) {
+        place_boundary<link<T, Act, Allocator>>(std::move(next));
+      } else {
+        place_boundary<terminator<T, Act, Allocator>>();
+      }
+    }
+
+    template <class T, class Act, class Allocator>
+    constexpr size_t segment<T, Act, Allocator>::boundary_size() noexcept {
+      return pad_to_alignment<alignment>(std::max<size_t>(sizeof(link<T, Act, Allocator>), sizeof(terminator<T, Act, Allocator>)));
+    }
+
+    template <class T, class Act, class Allocator>
+    segment<T, Act, Allocator> const * segment<T, Act, Allocator>::next_segment() const noexcept {
+      if (memory == nullptr) return nullptr;
+      link<T, Act, Allocator> const * l = boundary()->as_link();
+      return l ? &l->segment : nullptr;
+    }
+
+    template <class T, class Act, class Allocator>
+    void segment<T, Act, Allocator>::append(segment<T, Act, Allocator> && older) noexcept {
+      assert(memory != nullptr);
+      if (older.memory == nullptr) return;
+      segment * s = this;
+      while (segment * n = s->next_segment()) s = n;
+      abstract_record_type * b = s->boundary();
+      b->destroy();
+      // the slot is already reserved, so bypass the bump allocator
+      ::new (static_cast<void *>(b)) link<T, Act, Allocator>(std::move(older));
+    }
+
+    template <class T, class Act, class Allocator>
+    void segment<T, Act, Allocator>::reset() noexcept {
+      if (memory == nullptr) return;
+      abstract_record<T, Act, Allocator> * b BAD(align_value(record_alignment)) = boundary();
+      unwind(b);
+      if (link<T, Act, Allocator> * link BAD(align_value(record_alignment)) = b->as_link()) {
+        // older segments die with temp
+        segment<T, Act, Allocator> temp = std::move(link->segment);
+        b->destroy();
+      } else {
+        b->destroy();
+      }
+      trivial = true;
+      place_boundary<terminator<T, Act, Allocator>>();
+    }
+  }
+
+  /// a non-terminal entry designed for allocation in a slab
+  /// \ingroup tapes_group
+#ifdef DOXYGEN
+  template <class B, class T, class Act, class Allocator>
+#else
+  template <class B, class T, class Act = T *, class Allocator = default_allocator>
+#endif
+  struct record : abstract_record<T,Act,Allocator> {
+    using abstract_record_type = abstract_record<T,Act,Allocator>;
+
+    BAD(hd,inline,noalias)
+    record() noexcept : abstract_record<T,Act,Allocator>() {
+      this->tag = detail::record_tag<B>();
+    }
+
+    BAD(hd,inline,flatten,const,assume_aligned(record_alignment))
+    abstract_record_type const * next() const noexcept override final {
+      return reinterpret_cast<abstract_record_type const *>(reinterpret_cast<std::byte const*>(this) + detail::pad_to_alignment<abstract_record_type::alignment>(sizeof(B)));
+      // if it wasn't for alignment we could just static_cast<abstract_record_type>(this+1) and be constexpr?
+    }
+
+    BAD(hd,inline,flatten,const,assume_aligned(record_alignment))
+    abstract_record_type * next() noexcept override final {
+      return reinterpret_cast<abstract_record_type *>(reinterpret_cast<std::byte*>(this) + detail::pad_to_alignment<abstract_record_type::alignment>(sizeof(B)));
+    }
+
+    BAD(hd,flatten)
+    void what(BAD(noescape) std::ostream & os) const noexcept override final {
+      os << type(*static_cast<B const *>(this));
+    }
+
+    BAD(hd,inline)
+    void destroy() noexcept override final {
+      static_cast<B *>(this)->~B();
+    }
+
+    BAD(hd,inline,flatten,assume_aligned(record_alignment))
+    const abstract_record_type * propagate(Act act, BAD(noescape) size_t & i) const noexcept override final {
+      B const * self = reinterpret_cast<B const *>(this);
+      i -= self->B::activations(); // qualified, so this doesn't go back through the vtable
+      self->prop(act, i);
+      return next(); // this shares the virtual function call dispatch, because here it isn't virtual.
+    }
+  };
+
+  /// a non-terminal entry designed for allocation in a slab, that produces a fixed number of activation abstract_records
+  /// \ingroup tapes_group
+#ifdef DOXYGEN
+  template <size_t Acts, class B, class T, class Act, class Allocator>
+#else
+  template <size_t Acts, class B, class T, class Act = T*, class Allocator = default_allocator>
+#endif
+  struct static_record : record<B,T,Act,Allocator> {
+
+    BAD(hd,inline,noalias)
+    static_record() noexcept : record<B,T,Act,Allocator>() {}
+
+    static constexpr size_t acts = Acts;
+
+    BAD(hd,inline,const) constexpr
+    size_t activations() const noexcept override final {
+      return acts;
+    }
+  };
+
+  namespace detail {
+
+    /// \ingroup tapes_group
+    template <class T, class Act, class Allocator = default_allocator>
+    struct const_tape_iterator final {
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = abstract_record<T,Act,Allocator> const;
+      using pointer = value_type *;
+      using reference = value_type &;
+      using const_pointer = pointer;
+      using const_reference = reference;
+  
+      pointer p;
+  
+      BAD(hd,inline,noalias) constexpr
+      const_tape_iterator() noexcept : p() {}
+  
+      BAD(hd,inline,noalias) constexpr
+      explicit const_tape_iterator(pointer p) noexcept : p(p) {}
+  
+      BAD(hd,inline,noalias) constexpr
+      const_tape_iterator(const const_tape_iterator & rhs) noexcept : p(rhs.p) {}
+  
+      BAD(hd,inline,noalias) constexpr
+      const_tape_iterator(const_tape_iterator &&  rhs) noexcept : p(std::move(rhs.p)) {}
+  
+      BAD(hd,inline,pure) constexpr
+      friend bool operator == (const_tape_iterator lhs, const_tape_iterator rhs) noexcept {
+        return lhs.p == rhs.p;
+      }
+  
+      BAD(hd,inline,pure) constexpr
+      friend bool operator != (const_tape_iterator lhs, const_tape_iterator rhs) noexcept {
+        return lhs.p != rhs.p;
+      }
+  
+      BAD(hd,inline,pure,assume_aligned(record_alignment)) constexpr
+      reference operator *() const noexcept { return *p; }
+  
+      BAD(hd,inline,pure,assume_aligned(record_alignment)) constexpr
+      pointer operator -> () noexcept { return p; }
+  
+      BAD(hd,inline,noalias)
+      const_tape_iterator & operator ++ () noexcept {
+        assert(p != nullptr);
+        p = p->next();
+        return *this;
+      }
+  
+      BAD(hd,inline,noalias)
+      const_tape_iterator operator ++ (int) noexcept {
+        assert(p != nullptr);
+        auto q = p;
+        p = p->next();
+        return q;
+      }
+  
+      BAD(hd,inline,pure,assume_aligned(record_alignment)) constexpr
+      pointer ptr() noexcept { return p; }
+  
+      BAD(hd,inline,pure,assume_aligned(record_alignment)) constexpr
+      const_pointer const_ptr() const noexcept { return p; }
+  
+      BAD(hd,inline,pure) constexpr
+      operator bool() const noexcept {
+        return p != nullptr;
+      }
+    };
+  
+    /// \ingroup tapes_group
+    template <class T, class Act, class Allocator = default_allocator>
+    struct tape_iterator final {
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = abstract_record<T,Act,Allocator>;
+      using pointer = value_type *;
+      using reference = value_type &;
+      using const_pointer = value_type const *;
+      using const_reference = value_type const &;
+  
+      pointer p;
+  
+      BAD(hd,inline,noalias) constexpr
+      tape_iterator() noexcept : p() {}
+  
+      BAD(hd,inline,noalias) constexpr
+      explicit tape_iterator(pointer p) noexcept : p(p) {}
+  
+      BAD(hd,inline,noalias) constexpr
+      tape_iterator(tape_iterator const & rhs) noexcept : p(rhs.p) {}
+  
+      BAD(hd,inline,noalias) constexpr
+      tape_iterator(tape_iterator &&  rhs) noexcept : p(std::move(rhs.p)) {}
+  
+      BAD(hd,inline,pure) constexpr
+      friend bool operator == (tape_iterator lhs, tape_iterator rhs) noexcept {
+        return lhs.p == rhs.p;
+      }
+  
+      BAD(hd,inline,pure) constexpr
+      friend bool operator != (tape_iterator lhs, tape_iterator rhs) noexcept {
+        return lhs.p != rhs.p;
+      }
+  
+      BAD(hd,inline,pure,assume_aligned(record_alignment)) constexpr
+      reference operator *() const noexcept {
+        return *p;
+      }
+  
+      BAD(hd,inline,pure,assume_aligned(record_alignment)) constexpr
+      pointer operator -> () noexcept {
+        return p;
+      }
+  
+      BAD(hd,inline,noalias)
+      tape_iterator & operator ++ () noexcept {
+        assert(p != nullptr);
+        p = p->next();
+        return *this;
+      }
+  
+      BAD(hd,inline,noalias)
+      tape_iterator operator ++ (int) noexcept {
+        assert(p != nullptr);
+        auto q = p;
+        p = p->next();
+        return q;
+      }
+  
+      BAD(hd,inline,pure,assume_aligned(record_alignment)) constexpr
+      pointer ptr() noexcept {
+        return p;
+      }
+  
+      BAD(hd,inline,pure,assume_aligned(record_alignment)) constexpr
+      const_pointer const_ptr() const noexcept {
+        return p;
+      }
+  
+      BAD(hd,inline,pure) constexpr
+      operator bool() const noexcept {
+        return p != nullptr;
+      }
+  
+      BAD(hd,inline,pure) constexpr
+      operator const_tape_iterator<T,Act,Allocator> () const noexcept {
+        return p;
+      }
+    };
+
+    /// \ingroup tapes_group
+    template <class T, class Act, class Allocator>
+    BAD(hd,inline,noalias)
+    void swap (
+      BAD(noescape) tape_iterator<T,Act,Allocator> & a,
+      BAD(noescape) tape_iterator<T,Act,Allocator> & b
+    ) {
+      using std::swap;
+      swap(a.p,b.p);
+    }
+  
+    /// \ingroup tapes_group
+    template <class T,class Act,class Allocator>
+    BAD(hd,inline,noalias)
+    void swap (
+      BAD(noescape) const_tape_iterator<T,Act,Allocator> & a,
+      BAD(noescape) const_tape_iterator<T,Act,Allocator> & b
+    ) {
+      using std::swap;
+      swap(a.p,b.p);
+    }
+  }
+
+  /// \brief how big to make each new segment of a \ref bad::tapes::tape "tape"
+  ///
+  /// Segments grow geometrically by `factor` from `initial` up to `cap`, so a tape holding gigabytes is a short
+  /// chain of big slabs while a small tape stays small. Set `factor` to 1 for fixed size segments.
+  ///
+  /// With `from_peak` set, \ref bad::tapes::tape::clear "clear" replaces a multi-segment tape with a single slab
+  /// big enough for everything it just held, so the next iteration of a loop recording the same shape
+  /// fits without links.
+  /// \ingroup tapes_group
+  struct segment_growth {
+    size_t initial = 0; ///< size of the first segment, 0 for the allocator's segment size
+    size_t factor = 2; ///< each segment is this many times the size of the last
+    size_t cap = size_t(64) << 20; ///< don't grow past this, unless a single record needs more
+    bool from_peak = true; ///< let clear() size the retained slab from the last recording
+
+    /// the size of the segment following one of `previous` bytes (0 if none), which must fit `needed`
+    /// and be a multiple of `granularity`, which must be a power of two.
+    BAD(hd,pure)
+    size_t operator()(size_t previous, size_t needed, size_t granularity) const noexcept {
+      size_t n = previous == 0
+        ? initial
+        : previous > cap / std::max<size_t>(factor,1) ? cap : previous * std::max<size_t>(factor,1);
+      n = std::min(n, cap);
+      n = std::max(n, needed);
+      return std::max(granularity, (n + granularity - 1) & ~(granularity - 1));
+    }
+  };
+
+  /// bytes of slabs currently held by the segments of every tape in the process, on any thread.
+  ///
+  /// Slabs cached by a \ref bad::tapes::segment_pool "segment_pool" aren't counted.
+  /// \ingroup tapes_group
+  BAD(hd,inline)
+  size_t resident_tape_bytes() noexcept {
+    return detail::resident_tape_bytes.load(std::memory_order_relaxed);
+  }
+
+  /// which threshold of a \ref bad::tapes::tape_budget "tape_budget" a tape is about to cross
+  /// \ingroup tapes_group
+  enum class budget_level { soft, hard };
+
+  /// \brief how many bytes of slabs a \ref bad::tapes::tape "tape" may hold, and who to tell as it grows past that.
+  ///
+  /// Checked whenever the tape is about to take on more slabs. `handler(context, level, bytes)` is called with
+  /// the total the tape would hold after growing:
+  ///
+  /// - once with `budget_level::soft` when that first exceeds `soft`, and again only after the tape has been
+  ///   cleared or rewound below it, as a cue to checkpoint, spill or flush once the current push returns
+  /// - with `budget_level::hard` every time it would exceed `hard`. Returning true lets the tape grow anyway,
+  ///   so the handler can block until memory elsewhere is freed, or raise `hard`. Returning false, or having no
+  ///   handler, refuses: \ref bad::tapes::tape::try_push "try_push" returns nullptr, and
+  ///   \ref bad::tapes::tape::push "push" calls \ref bad::memory::allocation_failure "allocation_failure"
+  ///   rather than let the tape run the process out of memory.
+  ///
+  /// Besides new segments, the tape consults its budget before \ref bad::tapes::tape::clear "clear" keeps a
+  /// slab sized for its peak, and before it takes on the segments of a spliced child or a frozen copy of itself.
+  /// The handler runs in the middle of these, so it must not touch the tape that is growing.
+  /// \ingroup tapes_group
+  struct tape_budget {
+    static constexpr size_t unlimited = static_cast<size_t>(-1);
+
+    size_t soft = unlimited; ///< bytes past which `handler` is warned
+    size_t hard = unlimited; ///< bytes past which the tape may only grow with `handler`'s consent
+    bool (*handler)(void * context, budget_level level, size_t bytes) noexcept = nullptr;
+    void * context = nullptr; ///< passed to `handler`
+
+    /// may a tape holding `bytes` grow by `more`? notifies `handler` as described above
+    BAD(hd)
+    bool admit(size_t bytes, size_t more) const noexcept {
+      size_t next = bytes > unlimited - more ? unlimited : bytes + more;
+      if (bytes <= soft && next > soft && handler != nullptr) handler(context, budget_level::soft, next);
+      if (next <= hard) return true;
+      return handler != nullptr && handler(context, budget_level::hard, next);
+    }
+  };
+
+  /// the default sweep strategy: every record goes through its vtable
+  /// \ingroup tapes_group
+  struct virtual_dispatch {
+    template <class T, class Act, class Allocator>
+    BAD(hd,inline,flatten)
+    abstract_record<T,Act,Allocator> const * operator()(
+      BAD(noescape) abstract_record<T,Act,Allocator> const * p,
+      Act act,
+      BAD(noescape) size_t & i
+    ) const noexcept {
+      return p->propagate(act, i);
+    }
+  };
+
+  /// \brief a contiguous, cache-line aligned activation buffer for reverse sweeps.
+  ///
+  /// Produced by \ref bad::tapes::tape::backprop "tape::backprop". Storage is retained
+  /// across calls to \ref reset, so a training loop can hand the same buffer back in on every step.
+  /// \ingroup tapes_group
+  template <class U>
+  struct adjoints final {
+    using value_type = U;
+    using iterator = U *;
+    using const_iterator = U const *;
+
+    static_assert(std::is_trivially_destructible_v<U>, "adjoints are never destroyed");
+
+    U * memory; ///< cache_line_size aligned storage
+    size_t n; ///< number of live adjoints
+    size_t capacity; ///< number of adjoints memory can hold
+    size_t constructed; ///< number of slots holding objects, at least `n`
+
+    BAD(hd,inline,noalias) constexpr
+    adjoints() noexcept
+    : memory(nullptr), n(0), capacity(0), constructed(0) {}
+
+    BAD(hd,noalias) explicit
+    adjoints(size_t n) noexcept
+    : adjoints() {
+      reset(n);
+    }
+
+    BAD(hd)
+    adjoints(adjoints const &) = delete;
+
+    BAD(hd)
+    adjoints & operator = (adjoints const &) = delete;
+
+    BAD(hd,inline,noalias)
+    adjoints(adjoints && rhs) noexcept
+    : memory(rhs.memory), n(rhs.n), capacity(rhs.capacity), constructed(rhs.constructed) {
+      rhs.memory = nullptr;
+      rhs.n = rhs.capacity = rhs.constructed = 0;
+    }
+
+    BAD(reinitializes,hd,inline,noalias)
+    adjoints & operator = (adjoints && rhs) noexcept {
+      using std::swap;
+      swap(memory, rhs.memory);
+      swap(n, rhs.n);
+      swap(capacity, rhs.capacity);
+      swap(constructed, rhs.constructed);
+      return *this;
+    }
+
+    BAD(hd,inline)
+    ~adjoints() noexcept {
+      if (memory != nullptr) allocator().deallocate(memory);
+    }
+
+    /// resize to `k` zeroed adjoints, only touching the allocator when the buffer has to grow.
+    ///
+    /// slots that already hold an object are assigned, the rest are constructed in place.
+    BAD(hd,noalias)
+    void reset(size_t k) noexcept {
+      if (k > capacity) {
+        if (memory != nullptr) allocator().deallocate(memory);
+        memory = allocator().allocate(k);
+        capacity = k;
+        constructed = 0;
+      }
+      n = k;
+      std::fill_n(memory, std::min(k, constructed), U());
+      if (k > constructed) {
+        std::uninitialized_fill_n(memory + constructed, k - constructed, U());
+        constructed = k;
+      }
+    }
+
+    BAD(hd,inline,pure) constexpr
+    size_t size() const noexcept { return n; }
+
+    BAD(hd,inline,pure,assume_aligned(cache_line_size)) constexpr
+    U * data() noexcept { return memory; }
+
+    BAD(hd,inline,pure,assume_aligned(cache_line_size)) constexpr
+    U const * data() const noexcept { return memory; }
+
+    BAD(hd,inline,pure) constexpr
+    U & operator[](size_t i) noexcept {
+      assert(i < n);
+      return memory[i];
+    }
+
+    BAD(hd,inline,pure) constexpr
+    U const & operator[](size_t i) const noexcept {
+      assert(i < n);
+      return memory[i];
+    }
+
+    BAD(hd,inline,pure) constexpr
+    iterator begin() noexcept { return memory; }
+
+    BAD(hd,inline,pure) constexpr
+    iterator end() noexcept { return memory + n; }
+
+    BAD(hd,inline,pure) constexpr
+    const_iterator begin() const noexcept { return memory; }
+
+    BAD(hd,inline,pure) constexpr
+    const_iterator end() const noexcept { return memory + n; }
+
+  private:
+    BAD(hd,inline,const) constexpr
+    static aligned_allocator<U, cache_line_size> allocator() noexcept { return {}; }
+  };
+
+  template <class T, class Act, class Allocator>
+  struct tape final {
+  protected:
+    using abstract_record_type = abstract_record<T,Act,Allocator>;
+  public:
+    using iterator = detail::tape_iterator<T,Act,Allocator>;
+    using const_iterator = detail::const_tape_iterator<T,Act,Allocator>;
+    using adjoint_type = std::remove_pointer_t<Act>; ///< what \ref backprop stores per activation
+
+    /// records spliced in from a \ref fork that number their own activations from `base` rather than `start`
+    struct section {
+      abstract_record_type const * top; ///< newest record of the section
+      std::byte * bottom; ///< memory of the oldest segment of the section
+      size_t base; ///< first activation the section owns, as numbered by its records
+      size_t count; ///< number of activations the section owns
+      size_t start; ///< first activation the section owns on this tape
+    };
+
+    detail::segment<T, Act, Allocator> segment;  ///< current segment
+    size_t activations; ///< number of records required to propagate activations
+    size_t bytes; ///< total size of the slabs held by this tape
+    segment_growth growth; ///< sizing policy for new segments
+    tape_budget budget; ///< limits on `bytes`, checked as the tape takes on more slabs
+    size_t base; ///< activations below this belong to the tape we were forked from
+    std::vector<section> sections; ///< spliced sections that need renumbering during a sweep, oldest first
+
+    /// a saved recording position, see \ref mark and \ref rewind
+    struct position {
+      abstract_record_type * current; ///< newest record at the time of the mark
+      std::byte * memory; ///< the segment it lives in
+      size_t activations; ///< activations at the time of the mark
+    };
+
+    BAD(hd,noalias)
+    tape() noexcept
+    : segment(), activations(), bytes(), growth(), budget(), base(), sections() {}
+
+    BAD(hd,noalias) explicit
+    tape(segment_growth growth) noexcept
+    : segment(), activations(), bytes(), growth(growth), budget(), base(), sections() {}
+
+    BAD(hd,noalias) explicit
+    tape(tape_budget budget, segment_growth growth = segment_growth()) noexcept
+    : segment(), activations(), bytes(), growth(growth), budget(budget), base(), sections() {}
+
+    BAD(hd,noalias)
+    tape(tape<T, Act, Allocator> && rhs) noexcept
+    : segment(std::move(rhs.segment))
+    , activations(std::move(rhs.activations))
+    , bytes(std::move(rhs.bytes))
+    , growth(rhs.growth)
+    , budget(rhs.budget)
+    , base(rhs.base)
+    , sections(std::move(rhs.sections)) {
+      rhs.activations = rhs.base;
+      rhs.bytes = 0;
+      rhs.sections.clear();
+    }
+
+    BAD(hd)
+    tape(tape<T, Act, Allocator> const &) = delete;
+
+    BAD(maybe_unused,hd)
+    tape<T, Act, Allocator> & operator=(tape<T, Act, Allocator> const &) = delete;
+
+    BAD(reinitializes,maybe_unused,hd,noalias)
+    tape<T, Act, Allocator> & operator=(tape<T, Act, Allocator> && rhs) noexcept;
+
+  private:
+    template <class>
+    struct is_record_t : std::false_type {};
+
+    template <class B>
+    struct is_record_t<record<B,Act,Allocator>> : std::true_type {};
+
+    template <class B>
+    static constexpr bool is_record = is_record_t<B>::value;
+
+  public:
+    /// record a `U`, constructed from `args`. calls \ref bad::memory::allocation_failure "allocation_failure"
+    /// if it needs a new segment and `budget` refuses, see \ref try_push
+    template <class U, class ... Args>
+    BAD(maybe_unused,hd,flatten,noalias)
+    U & push(Args ... args) noexcept {
+      U * result BAD(align_value(record_alignment)) = try_push<U>(std::forward<Args>(args)...);
+      if (result == nullptr) allocation_failure();
+      return *result;
+    }
+
+    /// record a `U`, constructed from `args`, unless it needs a new segment and `budget` refuses, in which
+    /// case returns nullptr and leaves the tape as it was
+    template <class U, class ... Args>
+    BAD(maybe_unused,hd,flatten,noalias,nodiscard)
+    U * try_push(Args ... args) noexcept {
+      static_assert(std::is_base_of_v<abstract_record_type, U>, "only push records");
+      static_assert(!std::is_same_v<U, detail::link<T,Act,Allocator>>,"links should not be pushed");
+      static_assert(!std::is_same_v<U, detail::terminator<T,Act,Allocator>>,"terminators should not be pushed");
+      static_assert(alignof(U) <= abstract_record_type::alignment, "alignment requirement is too strict for the tape. use an allocator with a larger record_alignment");
+      // deliberately excludes link and terminator
+
+      U * result BAD(align_value(record_alignment)) = new (*this, std::nothrow) U(std::forward<Args>(args)...);
+      if (result == nullptr) return nullptr;
+      // checked per type at compile time, and only ever cleared, so all-trivial segments never pay for a destructor walk
+      if constexpr (!std::is_trivially_destructible_v<U>) segment.trivial = false;
+      activations += result->activations();
+      return result;
+    }
+
+    BAD(hd,pure) constexpr
+    iterator begin() noexcept {
+      return iterator(segment.current);
+    }
+
+    BAD(hd,const) constexpr
+    iterator end() noexcept {
+      return iterator();
+    }
+
+    BAD(hd,pure) constexpr
+    const_iterator begin() const noexcept {
+      return const_iterator(segment.current);
+    }
+
+    BAD(hd,const) constexpr
+    const_iterator end() const noexcept {
+      return const_iterator();
+    }
+
+    BAD(hd,pure) constexpr
+    const_iterator cbegin() const noexcept {
+      return const_iterator(segment.current);
+    }
+
+    BAD(hd,const) constexpr
+    const_iterator cend() noexcept {
+      return const_iterator();
+    }
+
+    /// remember the current recording position
+    BAD(hd,pure)
+    position mark() const noexcept {
+      return { segment.current, segment.memory, activations };
+    }
+
+    /// destroy every record pushed since `m` was taken, keeping the slab `m` lives in.
+    ///
+    /// whole segments recorded after the mark go back to the thread's \ref bad::tapes::segment_pool "segment_pool",
+    /// so re-recording from here is a bump-pointer write until we outgrow what we had before.
+    BAD(hd,noalias)
+    void rewind(position m) noexcept {
+      if (m.memory == nullptr) return clear();
+      if (segment.memory != m.memory) {
+        while (segment.memory != m.memory) {
+          assert(segment.memory != nullptr); // m came from some other tape, or was already rewound past
+          if (!sections.empty() && sections.back().bottom == segment.memory) sections.pop_back();
+          bytes -= segment.size;
+          segment.pop();
+        }
+        detail::unseal<Allocator>(segment.memory, segment.size); // we record into it again
+      }
+      segment.unwind(m.current);
+      activations = m.activations;
+    }
+
+    /// destroy every record, retaining the newest slab for future recording.
+    ///
+    /// if we spilled into several segments and `growth.from_peak` is set, retain one slab that can hold all of it
+    /// instead, as long as `budget` admits a slab that size.
+    BAD(hd,noalias)
+    void clear() noexcept {
+      activations = base;
+      sections.clear();
+      size_t n = 0; // size of the slab to keep in place of the chain, if any
+      if (growth.from_peak && bytes > segment.size) {
+        size_t peak = bytes - size_t(reinterpret_cast<std::byte *>(segment.current) - segment.memory);
+        n = growth(0, peak, detail::segment<T,Act,Allocator>::minimum_size);
+      }
+      if (n != 0 && budget.admit(0, n)) {
+        segment = detail::segment<T,Act,Allocator>(); // return everything to the pool first
+        segment = detail::segment<T,Act,Allocator>(n, detail::segment<T,Act,Allocator>());
+        bytes = segment.size;
+      } else {
+        segment.reset();
+        bytes = segment.size;
+      }
+      if (trace::use tr; tr) tr->open_burst(segment.memory, segment.current);
+    }
+
+    /// move every record into one contiguous slab, with a terminator at the end and no links.
+    ///
+    /// Worth it for a tape that will be swept many times, as in fixed-point iterations or repeated
+    /// vector-Jacobian products: the sweep becomes a single forward stream through memory. Sweeps never
+    /// modify the tape, so once frozen it can be swept from several threads at once, each with its own
+    /// adjoints. Recording can carry on afterwards, in new segments linked to the frozen one.
+    ///
+    /// Records are relocated bytewise, so they must not point into themselves or one another, and any
+    /// \ref mark taken before is invalidated. Returns false, leaving the tape as it was, if the `budget`
+    /// refuses the temporary second copy, or if the tape has spliced \ref sections, which are recognized by
+    /// the segments they end in.
+    BAD(hd,noalias,nodiscard)
+    bool freeze() noexcept {
+      if (!sections.empty()) return false;
+      if (segment.memory == nullptr || segment.next_segment() == nullptr) return true;
+      std::vector<detail::segment<T, Act, Allocator> *> chain; // newest first
+      size_t used = 0;
+      bool trivial = true;
+      for (auto s = &segment; s != nullptr; s = s->next_segment()) {
+        chain.push_back(s);
+        used += size_t(reinterpret_cast<std::byte *>(s->boundary()) - reinterpret_cast<std::byte *>(s->current));
+        trivial = trivial && s->trivial;
+      }
+      size_t n = used + detail::segment<T, Act, Allocator>::boundary_size();
+      if (!budget.admit(bytes, n)) return false;
+      detail::segment<T, Act, Allocator> flat(n);
+      auto top = reinterpret_cast<std::byte *>(flat.boundary());
+      // oldest records end up just below the terminator, the newest at the bottom, as if pushed in one go
+      for (auto s = chain.rbegin(); s != chain.rend(); ++s) {
+        auto from = reinterpret_cast<std::byte *>((*s)->current);
+        size_t k = size_t(reinterpret_cast<std::byte *>((*s)->boundary()) - from);
+        top -= k;
+        std::memcpy(static_cast<void *>(top), from, k);
+        // the records live on in flat. leave just the boundary behind, so nothing is destroyed twice
+        (*s)->current = (*s)->boundary();
+        (*s)->trivial = true;
+      }
+      flat.current = reinterpret_cast<abstract_record_type *>(top);
+      flat.trivial = trivial;
+      segment = std::move(flat); // the old chain is released with flat's old contents
+      bytes = segment.size;
+      return true;
+    }
+
+    /// true if every record lives in one segment, as after \ref freeze
+    BAD(hd,pure)
+    bool frozen() const noexcept {
+      return segment.memory == nullptr || segment.next_segment() == nullptr;
+    }
+
+    /// the tape this thread is recording to, if any. see \ref bad::tapes::recording "recording"
+    BAD(hd)
+    static tape<T, Act, Allocator> *& current() noexcept {
+      static thread_local tape<T, Act, Allocator> * t = nullptr;
+      return t;
+    }
+
+    /// a fresh tape for recording on another thread. its records may refer to every activation we have now,
+    /// and number their own from where we left off. see \ref splice.
+    ///
+    /// it has our growth policy and a copy of our budget, which only limits its own bytes: we and each child
+    /// may hold up to `budget.hard` apiece until they are spliced back in, when their bytes count against ours.
+    ///
+    /// only available when `Act` is a pointer, since the sweep may have to renumber the child's activations.
+    BAD(hd,nodiscard)
+    tape<T, Act, Allocator> fork() const noexcept {
+      static_assert(std::is_pointer_v<Act>, "forking requires a pointer activation type");
+      tape<T, Act, Allocator> result(budget, growth);
+      result.base = result.activations = activations;
+      return result;
+    }
+
+    /// take ownership of the segments of `child`, a \ref fork of this tape, as if its records had been pushed here.
+    ///
+    /// nothing is copied: the terminator at the end of the child's chain becomes a link to our segments.
+    /// if we have recorded anything since the fork, including other spliced children, the child's activations
+    /// land after those and the sweep renumbers them as it passes through. `child` is left empty.
+    ///
+    /// returns false, leaving both tapes as they were, if `budget` won't let us take on the child's bytes.
+    BAD(hd,noalias,nodiscard)
+    bool splice(tape<T, Act, Allocator> && child) noexcept {
+      static_assert(std::is_pointer_v<Act>, "renumbering spliced activations requires a pointer activation type");
+      assert(child.sections.empty()); // splice grandchildren into their parent first
+      assert(child.base <= activations);
+      if (child.bytes != 0 && !budget.admit(bytes, child.bytes)) return false;
+      size_t count = child.activations - child.base;
+      if (child.segment.memory != nullptr) {
+        auto oldest = &child.segment;
+        while (auto n = oldest->next_segment()) oldest = n;
+        section sec { child.segment.current, oldest->memory, child.base, count, activations };
+        if (sec.start != sec.base) sections.push_back(sec);
+        child.segment.append(std::move(segment));
+        segment = std::move(child.segment);
+        bytes += child.bytes;
+      }
+      activations += count;
+      child.activations = child.base;
+      child.bytes = 0;
+      return true;
+    }
+
+    /// run the reverse sweep over caller-managed activations, newest record first, one segment at a time
+    /// until we run out of segments.
+    ///
+    /// `step` propagates a single record and returns the next one, see \ref bad::tapes::dispatch "dispatch".
+    /// Records are prefetched \ref bad::tapes::detail::sweep_prefetch_distance "sweep_prefetch_distance"
+    /// bytes ahead, continuing into the next segment as we near the end of each one. Before each segment is
+    /// swept the allocator is asked to read ahead the segment after it, and once a segment is done it is told
+    /// so, if it has `will_need` and `swept` members. While a \ref bad::tapes::trace "trace" is started the
+    /// sweep and each segment it reads are reported to it.
+    template <class Dispatch = virtual_dispatch>
+    BAD(hd,flatten)
+    void sweep(Act act, BAD(noescape) Dispatch const & step = Dispatch()) const noexcept {
+      trace::use tr;
+      uint64_t started = 0;
+      if (tr) {
+        tr->close_burst(segment.memory, segment.current);
+        started = tr->now();
+      }
+      size_t i = activations;
+      abstract_record_type const * p = segment.current;
+      size_t k = sections.size(); // sections[k-1] is the next one we'll reach
+      bool inside = false;
+      for (auto s = segment.memory ? &segment : nullptr; s != nullptr;) {
+        auto next = s->next_segment();
+        if (next != nullptr) detail::will_need<Allocator>(next->memory, next->size);
+        // the link or terminator at the top of the slab has nothing to propagate
+        abstract_record_type const * boundary = s->boundary();
+        auto end = reinterpret_cast<std::byte const *>(boundary);
+        auto resume = next != nullptr ? reinterpret_cast<std::byte const *>(next->current) : end;
+        // records lie at increasing addresses up to the boundary, and we carry on from resume, so we can
+        // prefetch that stream a fixed distance ahead rather than waiting on each next()
+        auto run_to = [&](abstract_record_type const * stop) {
+          while (p != stop) {
+            auto ahead = reinterpret_cast<std::byte const *>(p) + detail::sweep_prefetch_distance;
+            detail::prefetch(ahead < end ? ahead : resume + (ahead - end));
+            p = step(p, act, i);
+          }
+        };
+        uint64_t segment_started = tr ? tr->now() : 0;
+        if (k != 0 && !inside) {
+          section const & sec = sections[k - 1];
+          auto top = reinterpret_cast<std::byte const *>(sec.top);
+          if (s->memory <= top && top < s->memory + s->size) {
+            run_to(sec.top);
+            enter(act, sec, i);
+            inside = true;
+          }
+        }
+        run_to(boundary);
+        if (tr) tr->complete("sweep segment", segment_started, size_t(end - reinterpret_cast<std::byte const *>(s->current)));
+        detail::swept<Allocator>(s->memory, s->size);
+        if (inside && s->memory == sections[k - 1].bottom) {
+          leave(act, sections[--k], i);
+          inside = false;
+        }
+        if (next != nullptr) p = next->current;
+        s = next;
+      }
+      assert(i == base);
+      if (tr) {
+        tr->complete("sweep", started, bytes);
+        tr->open_burst(segment.memory, segment.current);
+      }
+    }
+
+  private:
+    /// move a section's adjoints to where its records expect them, and switch `i` to their numbering
+    BAD(hd,inline)
+    static void enter(Act act, BAD(noescape) section const & sec, BAD(noescape) size_t & i) noexcept {
+      assert(i == sec.start + sec.count);
+      if constexpr (std::is_pointer_v<Act>) {
+        if (sec.start >= sec.base + sec.count) std::swap_ranges(act + sec.base, act + sec.base + sec.count, act + sec.start);
+        else std::rotate(act + sec.base, act + sec.start, act + sec.start + sec.count);
+      }
+      i = sec.base + sec.count;
+    }
+
+    /// undo \ref enter
+    BAD(hd,inline)
+    static void leave(Act act, BAD(noescape) section const & sec, BAD(noescape) size_t & i) noexcept {
+      assert(i == sec.base);
+      if constexpr (std::is_pointer_v<Act>) {
+        if (sec.start >= sec.base + sec.count) std::swap_ranges(act + sec.base, act + sec.base + sec.count, act + sec.start);
+        else std::rotate(act + sec.base, act + sec.base + sec.count, act + sec.start + sec.count);
+      }
+      i = sec.start;
+    }
+
+  public:
+    /// reset `result` to hold one zeroed adjoint per activation, seed `output`, and sweep.
+    ///
+    /// `result` keeps its storage between calls, so passing the same buffer back in each step
+    /// avoids allocating at all once it has grown to fit.
+    template <class Dispatch = virtual_dispatch>
+    BAD(hd)
+    void backprop(
+      BAD(noescape) adjoints<adjoint_type> & result,
+      size_t output,
+      adjoint_type seed = adjoint_type(1),
+      BAD(noescape) Dispatch const & step = Dispatch()
+    ) const noexcept {
+      static_assert(std::is_pointer_v<Act>, "managed backprop requires a pointer activation type");
+      assert(output < activations);
+      result.reset(activations);
+      result[output] = seed;
+      sweep(result.data(), step);
+    }
+
+    /// sweep into a freshly allocated buffer, seeding activation `output` with `seed`
+    template <class Dispatch = virtual_dispatch>
+    BAD(hd,nodiscard)
+    adjoints<adjoint_type> backprop(
+      size_t output,
+      adjoint_type seed = adjoint_type(1),
+      BAD(noescape) Dispatch const & step = Dispatch()
+    ) const noexcept {
+      adjoints<adjoint_type> result;
+      backprop(result, output, seed, step);
+      return result;
+    }
+  };
+
+  /// \brief makes a tape the one this thread records to, see \ref bad::tapes::tape::current "tape::current",
+  /// restoring the previous one at the end of the scope.
+  ///
+  /// ~~~{.cc}
+  /// auto child = parent.fork();
+  /// std::thread worker([&] {
+  ///   recording<double> r(child);
+  ///   tape<double>::current()->push<mul>(...);
+  /// });
+  /// worker.join();
+  /// if (!parent.splice(std::move(child))) ... // over budget, child keeps its records
+  /// ~~~
+  /// \ingroup tapes_group
+  template <class T, class Act = T*, class Allocator = default_allocator>
+  struct recording {
+    tape<T, Act, Allocator> * previous;
+
+    BAD(hd,noalias) explicit
+    recording(BAD(noescape) tape<T, Act, Allocator> & t) noexcept
+    : previous(tape<T, Act, Allocator>::current()) {
+      tape<T, Act, Allocator>::current() = &t;
+    }
+
+    BAD(hd)
+    recording(recording const &) = delete;
+
+    BAD(hd)
+    recording & operator = (recording const &) = delete;
+
+    BAD(hd,noalias)
+    ~recording() noexcept {
+      tape<T, Act, Allocator>::current() = previous;
+    }
+  };
+
+  /// \ingroup tapes_group
+  template <class T, class Act, class Allocator>
+  BAD(hd,inline,noalias)
+  void swap(
+    BAD(noescape) tape<T,Act,Allocator> & a,
+    BAD(noescape) tape<T,Act,Allocator> & b
+  ) noexcept {
+    using std::swap;
+    swap(a.segment, b.segment);
+    swap(a.activations, b.activations);
+    swap(a.bytes, b.bytes);
+    swap(a.growth, b.growth);
+    swap(a.budget, b.budget);
+    swap(a.base, b.base);
+    swap(a.sections, b.sections);
+  }
+
+  template <class T, class Act,class Allocator>
+  inline tape<T,Act,Allocator> & tape<T,Act,Allocator>::operator=(
+    tape<T,Act,Allocator> && rhs
+  ) noexcept {
+    swap(*this,rhs);
+    return *this;
+  }
+
+  template <class T, class Act, class Allocator>
+  inline void * abstract_record<T,Act,Allocator>::operator new(
+    size_t size,
+    BAD(noescape) tape_t & tape
+  ) noexcept {
+    void * result = abstract_record::operator new(size, tape, std::nothrow);
+    if (result == nullptr) allocation_failure(); // the budget refused
+    return result;
+  }
+
+  template <class T, class Act, class Allocator>
+  inline void * abstract_record<T,Act,Allocator>::operator new(
+    size_t size,
+    BAD(noescape) tape_t & tape,
+    std::nothrow_t const &
+  ) noexcept {
+    using namespace detail;
+    auto result = abstract_record::operator new(size, tape.segment);
+    if (result) return result;
+    size_t needed = pad_to_alignment<alignment>(size) + segment<T, Act, Allocator>::boundary_size();
+    auto sealed = tape.segment.memory;
+    auto sealed_size = tape.segment.size;
+    auto sealed_current = tape.segment.current;
+    size_t n = tape.growth(tape.segment.size, needed, segment<T, Act, Allocator>::minimum_size);
+    if (!tape.budget.admit(tape.bytes, n)) return nullptr;
+    trace::use tr;
+    uint64_t start = tr ? tr->now() : 0;
+    tape.segment = segment(n, std::move(tape.segment));
+    tape.bytes += tape.segment.size;
+    if (tr) {
+      tr->complete("segment", start, tape.segment.size);
+      if (sealed != nullptr) {
+        tr->close_burst(sealed, sealed_current);
+        tr->instant("link", sealed_size);
+      }
+      tr->open_burst(tape.segment.memory, tape.segment.current);
+    }
+    if (sealed != nullptr) seal<Allocator>(sealed, sealed_size);
+    result = abstract_record::operator new(size, tape.segment);
+    assert(result != nullptr);
+    return result;
+  }
+}
+
+namespace bad {
+  using namespace bad::tapes;
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef BAD_TAPES_TRACE_HH
+#define BAD_TAPES_TRACE_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#include "bad/attributes.hh"
+
+/// \file
+/// \brief timelines of tape allocation, recording and sweeps, in Chrome `trace_event` format
+/// \author Edward Kmett
+
+namespace bad::tapes {
+
+  /// one timestamped span or instant on a \ref trace timeline
+  /// \ingroup tapes_group
+  struct trace_event {
+    char const * name; ///< a string literal
+    char phase; ///< `'X'` for a span, `'i'` for an instant
+    uint32_t thread; ///< small per-thread id, in order of first use
+    uint64_t start; ///< nanoseconds since the trace was constructed
+    uint64_t duration; ///< nanoseconds, 0 for instants
+    size_t bytes; ///< how much memory the event concerns
+  };
+
+  struct trace;
+
+  namespace detail {
+    /// the trace tapes on every thread report to, if any
+    /// \ingroup tapes_group
+    inline std::atomic<trace *> active_trace { nullptr };
+
+    /// number of \ref bad::tapes::trace::use "uses" of the active trace in flight, which
+    /// \ref bad::tapes::trace::stop "trace::stop" waits out
+    /// \ingroup tapes_group
+    inline std::atomic<size_t> trace_users { 0 };
+
+    /// a small id for the calling thread, handed out in order of first use
+    /// \ingroup tapes_group
+    BAD(hd)
+    inline uint32_t trace_thread() noexcept {
+      static std::atomic<uint32_t> next { 1 };
+      static thread_local uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+      return id;
+    }
+  }
+
+  /// \brief an opt-in timeline of what tapes are doing, for finding where recording and sweeps stall.
+  ///
+  /// While a trace is \ref start "started", tapes on every thread report to it:
+  ///
+  /// - `segment`: a span covering the acquisition of each new segment, from the pool or the allocator
+  /// - `link`: an instant each time a full segment is sealed and linked beneath a new one
+  /// - `record`: a span for each burst of recording into a segment, from when the segment was opened, or
+  ///   the tape last swept or cleared, until it is sealed or swept, with the bytes recorded
+  /// - `sweep`: a span for each reverse sweep, with one nested `sweep segment` span per segment it reads
+  ///
+  /// \ref write dumps them as Chrome `trace_event` JSON, for `chrome://tracing` or Perfetto:
+  ///
+  /// ~~~{.cc}
+  /// trace tr;
+  /// tr.start();
+  /// train();
+  /// tr.stop();
+  /// tr.write("tape.json");
+  /// ~~~
+  ///
+  /// Events are only generated at segment boundaries and sweeps, never per record. With no trace started,
+  /// tapes pay one atomic load per new segment, clear, and sweep. Tapes hold a \ref use while they report,
+  /// and \ref stop, and so the destructor, waits for those to finish, so a trace can go away while tapes on
+  /// other threads are still running.
+  /// \ingroup tapes_group
+  struct trace {
+    using clock = std::chrono::steady_clock;
+
+    clock::time_point origin; ///< time 0 of the timeline
+    std::vector<trace_event> events; ///< in order of completion. lock `mutex` to read while started
+    mutable std::mutex mutex;
+
+  private:
+    /// where a recording burst started
+    struct burst {
+      uint64_t start;
+      void const * current;
+    };
+    std::unordered_map<void const *, burst> bursts; // open bursts, by segment memory
+
+  public:
+    /// \brief the active trace, if any, kept from being \ref stop "stopped" until this goes out of scope.
+    ///
+    /// Hold one for as long as you report to the trace, but don't stop a trace while holding one, on the
+    /// same thread, as that would wait forever.
+    struct use {
+      trace * tr; ///< null if no trace was active
+
+      BAD(hd)
+      use() noexcept
+      : tr(detail::active_trace.load(std::memory_order_acquire)) {
+        if (tr == nullptr) return;
+        // announce ourselves, then check we weren't stopped in the meantime. stop does the opposite
+        detail::trace_users.fetch_add(1, std::memory_order_seq_cst);
+        tr = detail::active_trace.load(std::memory_order_seq_cst);
+        if (tr == nullptr) detail::trace_users.fetch_sub(1, std::memory_order_release);
+      }
+
+      BAD(hd)
+      use(use const &) = delete;
+
+      BAD(hd)
+      use & operator = (use const &) = delete;
+
+      BAD(hd)
+      ~use() noexcept {
+        if (tr != nullptr) detail::trace_users.fetch_sub(1, std::memory_order_release);
+      }
+
+      BAD(hd,inline,pure) explicit
+      operator bool() const noexcept {
+        return tr != nullptr;
+      }
+
+      BAD(hd,inline,pure)
+      trace * operator -> () const noexcept {
+        return tr;
+      }
+    };
+
+    BAD(hd)
+    trace() noexcept
+    : origin(clock::now()) {}
+
+    BAD(hd)
+    trace(trace const &) = delete;
+
+    BAD(hd)
+    trace & operator = (trace const &) = delete;
+
+    BAD(hd)
+    ~trace() noexcept {
+      stop();
+    }
+
+    /// the trace tapes are currently reporting to, if any. only safe to dereference while holding a \ref use,
+    /// or from the thread that owns the trace
+    BAD(hd,inline)
+    static trace * active() noexcept {
+      return detail::active_trace.load(std::memory_order_acquire);
+    }
+
+    /// have tapes on every thread report to this trace, in place of any other
+    BAD(hd)
+    void start() noexcept {
+      detail::active_trace.store(this, std::memory_order_release);
+    }
+
+    /// stop reporting to this trace, if it is the active one, and wait until every \ref use of it is done.
+    ///
+    /// As a use is only held across one segment allocation, clear, or sweep, we yield rather than sleep.
+    BAD(hd)
+    void stop() noexcept {
+      trace * self = this;
+      detail::active_trace.compare_exchange_strong(self, nullptr, std::memory_order_seq_cst);
+      // uses of a trace that was replaced by another start are waited out too
+      while (detail::trace_users.load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+    }
+
+    /// nanoseconds since `origin`
+    BAD(hd)
+    uint64_t now() const noexcept {
+      return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - origin).count());
+    }
+
+    /// a span named `name` from `start` until now
+    BAD(hd)
+    void complete(char const * name, uint64_t start, size_t bytes = 0) noexcept {
+      uint64_t end = now();
+      std::lock_guard<std::mutex> lock(mutex);
+      events.push_back({ name, 'X', detail::trace_thread(), start, end - start, bytes });
+    }
+
+    /// an instant named `name`
+    BAD(hd)
+    void instant(char const * name, size_t bytes = 0) noexcept {
+      uint64_t t = now();
+      std::lock_guard<std::mutex> lock(mutex);
+      events.push_back({ name, 'i', detail::trace_thread(), t, 0, bytes });
+    }
+
+    /// recording into the segment at `memory` resumes with its newest record at `current`
+    BAD(hd)
+    void open_burst(void const * memory, void const * current) noexcept {
+      uint64_t t = now();
+      std::lock_guard<std::mutex> lock(mutex);
+      bursts[memory] = { t, current };
+    }
+
+    /// recording into the segment at `memory` pauses with its newest record at `current`. emits a `record`
+    /// span if a burst was open
+    BAD(hd)
+    void close_burst(void const * memory, void const * current) noexcept {
+      uint64_t t = now();
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = bursts.find(memory);
+      if (it == bursts.end()) return;
+      // records grow downward. a rewind can leave us above where we started
+      auto from = static_cast<std::byte const *>(it->second.current), to = static_cast<std::byte const *>(current);
+      size_t bytes = to < from ? size_t(from - to) : 0;
+      events.push_back({ "record", 'X', detail::trace_thread(), it->second.start, t - it->second.start, bytes });
+      bursts.erase(it);
+    }
+
+    /// the events as Chrome `trace_event` JSON, timestamps in microseconds
+    BAD(hd)
+    void write(BAD(noescape) std::ostream & os) const noexcept {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto pid = long(::getpid());
+      auto micros = [&](uint64_t ns) {
+        os << ns / 1000 << '.' << char('0' + ns / 100 % 10) << char('0' + ns / 10 % 10) << char('0' + ns % 10);
+      };
+      os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+      bool first = true;
+      for (auto const & e : events) {
+        os << (first ? "\n" : ",\n") << "{\"name\":\"" << e.name << "\",\"cat\":\"tape\",\"ph\":\"" << e.phase
+           << "\",\"pid\":" << pid << ",\"tid\":" << e.thread << ",\"ts\":";
+        micros(e.start);
+        if (e.phase == 'X') {
+          os << ",\"dur\":";
+          micros(e.duration);
+        } else {
+          os << ",\"s\":\"t\"";
+        }
+        os << ",\"args\":{\"bytes\":" << e.bytes << "}}";
+        first = false;
+      }
+      os << "\n]}\n";
+    }
+
+    /// \ref write the events to the file at `path`, replacing it. returns false if it couldn't be written
+    BAD(hd)
+    bool write(BAD(noescape) std::string const & path) const noexcept {
+      std::ofstream out(path, std::ios::out | std::ios::trunc);
+      if (!out) return false;
+      write(out);
+      out.close();
+      return !out.fail();
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,534 @@
+#include <array>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "bad/tapes.hh"
+
+#include "catch.hh"
+
+using namespace std;
+using namespace bad;
+
+namespace {
+  template <class B, class Allocator>
+  using rec = static_record<1, B, double, double*, Allocator>;
+
+  template <class Allocator = default_allocator>
+  struct var : rec<var<Allocator>, Allocator> {
+    inline void prop(double *, size_t) const noexcept {}
+    bool replay(double *, size_t) noexcept override { return true; }
+  };
+
+  template <class Allocator = default_allocator>
+  struct mul : rec<mul<Allocator>, Allocator> {
+    size_t a, b;
+    double va, vb;
+    mul(size_t a, double va, size_t b, double vb) noexcept : a(a), b(b), va(va), vb(vb) {}
+    inline void prop(double * act, size_t i) const noexcept {
+      act[a] += act[i] * vb;
+      act[b] += act[i] * va;
+    }
+    bool replay(double * values, size_t i) noexcept override {
+      va = values[a];
+      vb = values[b];
+      values[i] = va * vb;
+      return true;
+    }
+  };
+
+  template <class Allocator = default_allocator>
+  struct add : rec<add<Allocator>, Allocator> {
+    size_t a, b;
+    add(size_t a, size_t b) noexcept : a(a), b(b) {}
+    inline void prop(double * act, size_t i) const noexcept {
+      act[a] += act[i];
+      act[b] += act[i];
+    }
+    bool replay(double * values, size_t i) noexcept override {
+      values[i] = values[a] + values[b];
+      return true;
+    }
+  };
+
+  template <class Allocator = default_allocator>
+  struct scale : rec<scale<Allocator>, Allocator> {
+    size_t a;
+    double k;
+    scale(size_t a, double k) noexcept : a(a), k(k) {}
+    auto fields() const noexcept { return std::make_tuple(a, k); }
+    static void lane(double * act, size_t i, size_t a, double k) noexcept {
+      act[a] += act[i] * k;
+    }
+    inline void prop(double * act, size_t i) const noexcept {
+      lane(act, i, a, k);
+    }
+    bool replay(double * values, size_t i) noexcept override {
+      values[i] = values[a] * k;
+      return true;
+    }
+  };
+
+  // a few million records with an irregular mix of types, so the branch predictor can't just learn the period
+  template <class Allocator>
+  void build(tape<double, double*, Allocator> & t, size_t n) {
+    t.template push<var<Allocator>>();
+    t.template push<var<Allocator>>();
+    uint32_t x = 12345;
+    for (size_t i=2;i<n;++i) {
+      x = x * 1103515245 + 12345;
+      switch ((x >> 16) % 3) {
+        case 0: t.template push<mul<Allocator>>(i-1, 1.0001, i-2, 0.9999); break;
+        case 1: t.template push<add<Allocator>>(i-1, i-2); break;
+        default: t.template push<scale<Allocator>>(i-1, 0.5); break;
+      }
+    }
+  }
+}
+
+TEST_CASE("reverse sweep dispatch","[tapes]") {
+  // cache resident, where dispatch dominates, and well past the last level cache
+  for (size_t n : { size_t(1) << 15, size_t(1) << 22 }) {
+    tape<double> t;
+    build(t, n);
+    adjoints<double> buffer;
+    dispatch<mul<>,add<>,scale<>,var<>> d;
+
+    BENCHMARK("virtual dispatch, " + to_string(n) + " records") {
+      t.backprop(buffer, n - 1);
+      return buffer[0];
+    };
+
+    BENCHMARK("tagged dispatch, " + to_string(n) + " records") {
+      t.backprop(buffer, n - 1, 1., d);
+      return buffer[0];
+    };
+  }
+}
+
+TEST_CASE("sweep bandwidth","[tapes]") {
+  // well past the last level cache, so the sweep streams the tape in from memory. reading the same number
+  // of bytes in one flat pass is the most we can hope for
+  static constexpr size_t n = size_t(1) << 22;
+  tape<double> t;
+  build(t, n);
+  size_t bytes = stats(t).record_bytes;
+  vector<uint64_t> flat(bytes / sizeof(uint64_t), 1);
+  adjoints<double> buffer(n);
+  string mib = to_string(bytes >> 20) + " MiB";
+
+  BENCHMARK("sweep, " + mib) {
+    t.sweep(buffer.data());
+    return buffer[0];
+  };
+
+  BENCHMARK("sequential read, " + mib) {
+    uint64_t sum = 0;
+    for (auto x : flat) sum += x;
+    return sum;
+  };
+}
+
+TEST_CASE("replay","[tapes]") {
+  // evaluating at a new point: record a fresh tape and sweep it, or replay the old one and sweep that
+  static constexpr size_t n = size_t(1) << 15;
+  tape<double> t;
+  build(t, n);
+  replay_plan plan(t);
+  vector<double> values(n);
+  adjoints<double> buffer;
+  double x = 1;
+
+  BENCHMARK("re-record") {
+    tape<double> fresh;
+    build(fresh, n);
+    fresh.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+
+  BENCHMARK("replay") {
+    values[0] = x;
+    values[1] = x += 1e-3;
+    plan(values.data());
+    t.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+}
+
+TEST_CASE("pipelined sweeps","[tapes]") {
+  // a training loop: record a batch, sweep it, repeat. the pipeline sweeps each batch while the next records
+  static constexpr size_t n = size_t(1) << 16, batches = 16;
+  tape<double> t;
+  adjoints<double> buffer;
+
+  BENCHMARK("record then sweep, " + to_string(batches) + " batches") {
+    double sum = 0;
+    for (size_t b = 0; b < batches; ++b) {
+      t.clear();
+      build(t, n);
+      t.backprop(buffer, n - 1);
+      sum += buffer[0];
+    }
+    return sum;
+  };
+
+  sweep_pipeline<double> pipe;
+  BENCHMARK("pipelined, " + to_string(batches) + " batches") {
+    double sum = 0;
+    std::future<adjoints<double>> pending;
+    for (size_t b = 0; b < batches; ++b) {
+      auto & u = pipe.acquire();
+      build(u, n);
+      if (pending.valid()) sum += pending.get()[0];
+      pending = pipe.submit(u, n - 1);
+    }
+    return sum + pending.get()[0];
+  };
+}
+
+namespace {
+  // generic in the activation type, so the same graph can be swept one adjoint or several at a time
+  template <class Act>
+  struct gvar : static_record<1, gvar<Act>, double, Act> {
+    inline void prop(Act, size_t) const noexcept {}
+    bool inputs(size_t, std::vector<size_t> &) const noexcept override { return true; }
+  };
+
+  template <class Act>
+  struct gmul : static_record<1, gmul<Act>, double, Act> {
+    size_t a, b;
+    double va, vb;
+    gmul(size_t a, double va, size_t b, double vb) noexcept : a(a), b(b), va(va), vb(vb) {}
+    inline void prop(Act act, size_t i) const noexcept {
+      act[a] += act[i] * vb;
+      act[b] += act[i] * va;
+    }
+    bool inputs(size_t, std::vector<size_t> & out) const noexcept override {
+      out.push_back(a);
+      out.push_back(b);
+      return true;
+    }
+  };
+
+  // 64 inputs mixed through layers of products, with the last 64 activations as outputs
+  template <class Act>
+  void layers(tape<double, Act> & t) {
+    static constexpr size_t width = 64;
+    for (size_t j=0;j<width;++j) t.template push<gvar<Act>>();
+    for (size_t l=1;l<256;++l) {
+      size_t prev = t.activations - width;
+      for (size_t j=0;j<width;++j) t.template push<gmul<Act>>(prev + j, 1.0001, prev + (j * 7 + l) % width, 0.9999);
+    }
+  }
+}
+
+TEST_CASE("vector mode jacobians","[tapes]") {
+  tape<double> scalar;
+  layers(scalar);
+  tape<double, lanes<double,4>*> wide4;
+  layers(wide4);
+  tape<double, lanes<double,8>*> wide8;
+  layers(wide8);
+  vector<size_t> inputs, outputs;
+  for (size_t j=0;j<64;++j) {
+    inputs.push_back(j);
+    outputs.push_back(scalar.activations - 64 + j);
+  }
+  vector<double> out;
+  adjoints<double> buffer;
+  adjoints<lanes<double,4>> buffer4;
+  adjoints<lanes<double,8>> buffer8;
+
+  BENCHMARK("one sweep per row") {
+    out.assign(64 * 64, 0.);
+    for (size_t r=0;r<64;++r) {
+      scalar.backprop(buffer, outputs[r]);
+      for (size_t j=0;j<64;++j) out[r * 64 + j] = buffer[j];
+    }
+    return out[0];
+  };
+
+  BENCHMARK("4 lanes") {
+    jacobian(wide4, outputs, inputs, out, buffer4);
+    return out[0];
+  };
+
+  BENCHMARK("8 lanes") {
+    jacobian(wide8, outputs, inputs, out, buffer8);
+    return out[0];
+  };
+}
+
+TEST_CASE("sparse jacobians","[tapes]") {
+  // a banded constraint Jacobian, y[r] = x[r] * x[r+1] * x[r+2]
+  static constexpr size_t n = 1000;
+  using Act = lanes<double,4>*;
+  tape<double, Act> t;
+  vector<size_t> inputs, outputs;
+  for (size_t j=0;j<n;++j) {
+    inputs.push_back(t.activations);
+    t.push<gvar<Act>>();
+  }
+  for (size_t r=0;r+2<n;++r) {
+    size_t p = t.activations;
+    t.push<gmul<Act>>(r, 1.5, r + 1, 0.5);
+    outputs.push_back(t.activations);
+    t.push<gmul<Act>>(p, 0.75, r + 2, 2.);
+  }
+  sparse_jacobian<double, Act> J(t, outputs, inputs);
+  vector<double> values;
+  adjoints<lanes<double,4>> buffer;
+
+  BENCHMARK("dense, " + to_string(outputs.size()) + " rows in 4 lanes") {
+    jacobian(t, outputs, inputs, values, buffer);
+    return values[0];
+  };
+
+  BENCHMARK("sparse, " + to_string(J.colors) + " colors in 4 lanes") {
+    J(t, values, buffer);
+    return values[0];
+  };
+}
+
+namespace {
+  // generic in the scalar, so partials can be saved as dual numbers
+  template <class T>
+  struct smul : static_record<1, smul<T>, T> {
+    size_t a, b;
+    T va, vb;
+    smul(size_t a, T va, size_t b, T vb) noexcept : a(a), b(b), va(va), vb(vb) {}
+    inline void prop(T * act, size_t i) const noexcept {
+      act[a] += act[i] * vb;
+      act[b] += act[i] * va;
+    }
+  };
+
+  template <class T>
+  struct sadd : static_record<1, sadd<T>, T> {
+    size_t a, b;
+    sadd(size_t a, size_t b) noexcept : a(a), b(b) {}
+    inline void prop(T * act, size_t i) const noexcept {
+      act[a] += act[i];
+      act[b] += act[i];
+    }
+  };
+
+  // sum of x[j] * x[j+1], over inputs that are activations 0 .. n-1
+  template <class T>
+  size_t neighbours(tape<T> & t, vector<T> const & xs) {
+    size_t sum = t.activations;
+    t.template push<smul<T>>(0, xs[0], 1, xs[1]);
+    for (size_t j=1;j+1<xs.size();++j) {
+      size_t p = t.activations;
+      t.template push<smul<T>>(j, xs[j], j + 1, xs[j + 1]);
+      t.template push<sadd<T>>(sum, p);
+      sum = p + 1;
+    }
+    return sum;
+  }
+}
+
+TEST_CASE("hessian vector products","[tapes]") {
+  static constexpr size_t n = size_t(1) << 14;
+  vector<double> x(n, 1.5), v(n, 0.25), g, hv;
+
+  BENCHMARK("gradient") {
+    tape<double> t;
+    for (size_t j=0;j<n;++j) t.push<var<>>();
+    auto adjoint = t.backprop(neighbours(t, x));
+    return adjoint[0];
+  };
+
+  BENCHMARK("gradient and hessian-vector product") {
+    hvp(neighbours<mixed<double>>, x, v, g, hv);
+    return hv[0];
+  };
+}
+
+TEST_CASE("sparse hessians","[tapes]") {
+  // the tridiagonal Hessian of neighbours, by one product per input or one per color
+  static constexpr size_t n = 256;
+  vector<double> x(n, 1.5), g, values;
+  sparsity_pattern elements;
+  elements.rows = n - 1;
+  elements.cols = n;
+  elements.first.assign(1, 0);
+  for (size_t j=0;j+1<n;++j) {
+    elements.columns.push_back(uint32_t(j));
+    elements.columns.push_back(uint32_t(j + 1));
+    elements.first.push_back(elements.columns.size());
+  }
+  sparsity_pattern p;
+  hessian_sparsity(elements, p);
+  sparse_hessian<double> H(p);
+
+  BENCHMARK("dense, " + to_string(n) + " products") {
+    vector<double> unit(n, 0.), column;
+    double sum = 0;
+    for (size_t j=0;j<n;++j) {
+      unit[j] = 1;
+      hvp(neighbours<mixed<double>>, x, unit, g, column);
+      unit[j] = 0;
+      sum += column[j];
+    }
+    return sum;
+  };
+
+  BENCHMARK("sparse, " + to_string(H.colors) + " colors") {
+    H(neighbours<mixed<double>>, x, values, g);
+    return values[0];
+  };
+}
+
+TEST_CASE("static tapes","[tapes]") {
+  // a small fixed graph, where the per-record virtual call is most of the work
+  using sc = scale<>;
+  tape<double> t;
+  t.push<var<>>();
+  t.push<var<>>();
+  t.push<mul<>>(0, 1.5, 1, 2.5);
+  for (size_t i=3;i<11;++i) t.push<sc>(i-1, 0.5);
+  t.push<add<>>(10, 0);
+  static_tape<var<>, var<>, mul<>, sc, sc, sc, sc, sc, sc, sc, sc, add<>> s(
+    piecewise_construct, tuple(), tuple(), tuple(0, 1.5, 1, 2.5),
+    tuple(2, 0.5), tuple(3, 0.5), tuple(4, 0.5), tuple(5, 0.5), tuple(6, 0.5), tuple(7, 0.5), tuple(8, 0.5), tuple(9, 0.5),
+    tuple(10, 0)
+  );
+  adjoints<double> buffer;
+
+  BENCHMARK("dynamic tape") {
+    t.backprop(buffer, 11);
+    return buffer[0];
+  };
+
+  BENCHMARK("static tape") {
+    s.backprop(buffer, 11);
+    return buffer[0];
+  };
+}
+
+TEST_CASE("fused elementwise runs","[tapes]") {
+  // layers of an elementwise op over a vector, with a product tying each layer together
+  static constexpr size_t width = 1024, layers = 1024;
+  tape<double> t;
+  for (size_t j=0;j<width;++j) t.push<var<>>();
+  for (size_t l=1;l<layers;++l) {
+    size_t prev = t.activations - width;
+    t.push<mul<>>(prev, 1.0001, prev + 1, 0.9999);
+    for (size_t j=1;j<width;++j) t.push<scale<>>(prev + j, 0.5);
+  }
+  size_t n = t.activations;
+  adjoints<double> buffer;
+
+  BENCHMARK("unfused sweep") {
+    t.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+
+  fuse<scale<>>(t);
+
+  BENCHMARK("fused sweep") {
+    t.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+}
+
+TEST_CASE("frozen tapes","[tapes]") {
+  // fixed size segments, as a tape recorded under a tight growth policy ends up
+  static constexpr size_t n = size_t(1) << 20;
+  tape<double> t(segment_growth { 0, 1 });
+  build(t, n);
+  adjoints<double> buffer;
+
+  BENCHMARK("linked segments") {
+    t.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+
+  tape<double> u(segment_growth { 0, 1 });
+  build(u, n);
+  REQUIRE(u.freeze());
+  BENCHMARK("frozen") {
+    u.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+}
+
+namespace {
+  // carries four cache lines of weights, aligned as strictly as the tape allows
+  template <class Allocator>
+  struct wide : rec<wide<Allocator>, Allocator> {
+    size_t a;
+    alignas(abstract_record<double, double*, Allocator>::alignment) double w[32];
+    wide(size_t a, double k) noexcept : a(a) {
+      for (auto & x : w) x = k / 32;
+    }
+    inline void prop(double * act, size_t i) const noexcept {
+      double k = 0;
+      for (auto x : w) k += x;
+      act[a] += act[i] * k;
+    }
+  };
+
+  template <class Allocator>
+  void build_wide(tape<double, double*, Allocator> & t, size_t n) {
+    t.template push<var<Allocator>>();
+    for (size_t i=1;i<n;++i) t.template push<wide<Allocator>>(i-1, 0.999);
+  }
+}
+
+TEST_CASE("wide records","[tapes]") {
+  using wide_allocator = aligned_allocator<std::byte, 64>;
+  static constexpr size_t n = size_t(1) << 18;
+  tape<double> t;
+  build_wide(t, n);
+  tape<double, double*, wide_allocator> u;
+  build_wide(u, n);
+  adjoints<double> buffer;
+
+  BENCHMARK("16 byte aligned records, " + to_string(sizeof(wide<default_allocator>)) + " bytes each") {
+    t.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+
+  BENCHMARK("64 byte aligned records, " + to_string(sizeof(wide<wide_allocator>)) + " bytes each") {
+    u.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+}
+
+#ifdef BAD_HAS_MMAP
+TEST_CASE("huge page segments","[tapes]") {
+  // big enough that the default allocator's 64k segments cost a TLB miss apiece
+  static constexpr size_t n = size_t(1) << 23;
+  tape<double> small_pages;
+  build(small_pages, n);
+  tape<double, double*, huge_page_allocator<>> huge_pages;
+  build(huge_pages, n);
+  adjoints<double> buffer;
+
+  BENCHMARK("default_allocator sweep") {
+    small_pages.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+
+  BENCHMARK("huge_page_allocator sweep") {
+    huge_pages.backprop(buffer, n - 1);
+    return buffer[0];
+  };
+
+  BENCHMARK("default_allocator record") {
+    tape<double> t;
+    build(t, n);
+    return t.activations;
+  };
+
+  BENCHMARK("huge_page_allocator record") {
+    tape<double, double*, huge_page_allocator<>> t;
+    build(t, n);
+    return t.activations;
+  };
+}
+#endif
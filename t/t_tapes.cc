@@ -1,8 +1,14 @@
+#include <cmath>
 #include <iostream>
+#include <numeric>
+#include <sstream>
 #include <string>
 #include <array>
+#include <future>
+#include <thread>
 #include <tuple>
 
+#include "bad/mixed_mode.hh"
 #include "bad/sequences.hh"
 #include "bad/tapes.hh"
 
@@ -29,3 +35,1360 @@ TEST_CASE("tape works","[tapes]") {
   }
   REQUIRE(t.activations == 90);
 }
+
+struct var : static_record<1, var, double> {
+  inline void prop(act_t, size_t) const noexcept {}
+};
+
+// activation i = a * b
+struct mul : static_record<1, mul, double> {
+  size_t a, b;
+  double va, vb;
+  mul(size_t a, double va, size_t b, double vb) noexcept : a(a), b(b), va(va), vb(vb) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * vb;
+    act[b] += act[i] * va;
+  }
+};
+
+// activation i = k * a, padded out so a handful of these fill a segment
+struct scale : static_record<1, scale, double> {
+  size_t a;
+  double k;
+  std::array<double,2000> padding;
+  scale(size_t a, double k) noexcept : a(a), k(k) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * k;
+  }
+};
+
+TEST_CASE("backprop works","[tapes]") {
+  tape<double> t;
+  t.push<var>(); // x = 3
+  t.push<var>(); // y = 4
+  t.push<mul>(0,3.,1,4.); // z = x * y
+  t.push<mul>(2,12.,0,3.); // w = z * x
+  auto g = t.backprop(3);
+  REQUIRE(g.size() == 4);
+  REQUIRE(g[0] == 24); // 2xy
+  REQUIRE(g[1] == 9);  // x^2
+  REQUIRE(g[2] == 3);  // x
+
+  adjoints<double> buffer;
+  t.backprop(buffer, 2);
+  REQUIRE(buffer[0] == 4);
+  REQUIRE(buffer[1] == 3);
+  REQUIRE(buffer[3] == 0);
+  auto p = buffer.data();
+  t.backprop(buffer, 3);
+  REQUIRE(buffer.data() == p); // storage is reused
+  REQUIRE(buffer[0] == 24);
+}
+
+TEST_CASE("static tapes","[tapes]") {
+  using graph = static_tape<var, var, mul, mul>;
+  STATIC_REQUIRE(graph::activations == 4);
+  STATIC_REQUIRE(graph::offset<3> == 3);
+  graph t(std::piecewise_construct, std::tuple(), std::tuple(), std::tuple(0,3.,1,4.), std::tuple(2,12.,0,3.));
+  REQUIRE(t.get<3>().va == 12);
+  auto g = t.backprop(3);
+  REQUIRE(g.size() == 4);
+  REQUIRE(g[0] == 24);
+  REQUIRE(g[1] == 9);
+  REQUIRE(g[2] == 3);
+  adjoints<double> buffer;
+  t.backprop(buffer, 2);
+  REQUIRE(buffer[0] == 4);
+  REQUIRE(buffer[1] == 3);
+}
+
+TEST_CASE("backprop crosses segments","[tapes]") {
+  tape<double> t;
+  t.push<var>();
+  for (size_t i=0;i<20;++i) t.push<scale>(i, 2.);
+  auto g = t.backprop(20);
+  REQUIRE(g[0] == 1048576);
+  REQUIRE(g[10] == 1024);
+}
+
+TEST_CASE("dispatch agrees with virtual dispatch","[tapes]") {
+  tape<double> t;
+  t.push<var>();
+  t.push<var>();
+  for (size_t i=2;i<200;++i) {
+    if (i % 3) t.push<mul>(i-1, 1.5, i-2, 0.5);
+    else t.push<scale>(i-1, 0.75);
+  }
+  auto expected = t.backprop(199);
+  adjoints<double> actual;
+  t.backprop(actual, 199, 1., dispatch<mul,var>()); // scale falls back to the vtable
+  for (size_t i=0;i<200;++i) REQUIRE(actual[i] == expected[i]);
+  t.backprop(actual, 199, 1., dispatch<scale,mul,var>());
+  for (size_t i=0;i<200;++i) REQUIRE(actual[i] == expected[i]);
+}
+
+TEST_CASE("segments are recycled","[tapes]") {
+  auto & pool = segment_pool<>::local();
+  auto iteration = [] {
+    tape<double> t;
+    t.push<var>();
+    for (size_t i=0;i<20;++i) t.push<scale>(i, 2.);
+    return t.backprop(20)[0];
+  };
+  REQUIRE(iteration() == 1048576);
+  size_t misses = pool.misses;
+  REQUIRE(pool.bytes > 0);
+  REQUIRE(iteration() == 1048576);
+  REQUIRE(pool.misses == misses); // steady state never touches the allocator
+
+  pool.high_water_slabs = 0;
+  pool.trim();
+  REQUIRE(pool.bytes == 0);
+  iteration();
+  REQUIRE(pool.misses > misses);
+  REQUIRE(pool.slabs.empty());
+  pool.high_water_slabs = segment_pool<>::default_high_water_slabs;
+}
+
+// counts live instances, to check what rewind destroys
+struct counted : static_record<1, counted, double> {
+  static inline int live = 0;
+  std::array<double,1000> padding;
+  counted() noexcept { ++live; }
+  ~counted() noexcept { --live; }
+  inline void prop(act_t, size_t) const noexcept {}
+};
+
+TEST_CASE("rewind and clear","[tapes]") {
+  STATIC_REQUIRE(std::is_trivially_destructible_v<var>);
+  STATIC_REQUIRE(std::is_trivially_destructible_v<mul>);
+  STATIC_REQUIRE_FALSE(std::is_trivially_destructible_v<counted>);
+  tape<double> t;
+  t.push<var>();
+  REQUIRE(t.segment.trivial);
+  t.push<counted>();
+  REQUIRE(!t.segment.trivial);
+  auto m = t.mark();
+  auto misses = segment_pool<>::local().misses;
+  for (int iteration=0;iteration<3;++iteration) {
+    for (size_t i=0;i<40;++i) t.push<counted>();
+    REQUIRE(counted::live == 41);
+    REQUIRE(t.activations == 42);
+    t.rewind(m);
+    REQUIRE(counted::live == 1);
+    REQUIRE(t.activations == 2);
+    REQUIRE(&*t.begin() == m.current);
+    if (iteration == 0) misses = segment_pool<>::local().misses;
+    else REQUIRE(segment_pool<>::local().misses == misses);
+  }
+  t.push<mul>(0, 3., 1, 4.);
+  REQUIRE(t.backprop(2)[0] == 4);
+
+  for (size_t i=0;i<40;++i) t.push<counted>();
+  auto newest = t.segment.memory;
+  t.growth.from_peak = false;
+  t.clear();
+  REQUIRE(counted::live == 0);
+  REQUIRE(t.activations == 0);
+  REQUIRE(t.segment.memory == newest);
+  REQUIRE(t.begin()->next() == nullptr); // just the terminator
+  REQUIRE(t.segment.trivial);
+  t.push<var>();
+  t.push<var>();
+  t.push<mul>(0, 3., 1, 4.);
+  REQUIRE(t.segment.trivial);
+  REQUIRE(t.backprop(2)[1] == 3);
+}
+
+TEST_CASE("frozen tapes","[tapes]") {
+  tape<double> t;
+  t.push<var>();
+  for (size_t i=0;i<60;++i) {
+    if (i % 3 == 0) t.push<counted>();
+    else t.push<scale>(t.activations - 1, 1.5);
+  }
+  REQUIRE(!t.frozen());
+  auto expected = t.backprop(t.activations - 1);
+  size_t records = 0;
+  for (auto & r : t) records += r.as_link() == nullptr;
+  int live = counted::live;
+
+  REQUIRE(t.freeze());
+  REQUIRE(t.frozen());
+  REQUIRE(t.bytes == t.segment.size);
+  REQUIRE(!t.segment.trivial);
+  REQUIRE(counted::live == live); // relocated, not destroyed
+  size_t after = 0;
+  for (auto & r : t) after += r.as_link() == nullptr;
+  REQUIRE(after == records);
+
+  // a frozen tape is shared read-only by concurrent sweeps
+  adjoints<double> a, b;
+  std::thread other([&] { t.backprop(b, t.activations - 1); });
+  t.backprop(a, t.activations - 1);
+  other.join();
+  REQUIRE(std::equal(a.begin(), a.end(), expected.begin(), expected.end()));
+  REQUIRE(std::equal(b.begin(), b.end(), expected.begin(), expected.end()));
+
+  // and can still be recorded onto
+  size_t i = t.activations;
+  for (size_t k=0;k<10;++k) t.push<scale>(t.activations - 1, 2.);
+  REQUIRE(!t.frozen());
+  REQUIRE(t.backprop(i + 9)[i - 1] == 1024);
+  t.clear();
+  REQUIRE(counted::live == 0);
+
+  // spliced sections are found by the segments they end in, which freezing would free
+  tape<double> parent;
+  parent.push<var>();
+  auto child = parent.fork();
+  parent.push<var>(); // recorded after the fork, so the child becomes a section
+  for (size_t k=0;k<100;++k) child.push<scale>(k == 0 ? 0 : child.activations - 1, 1.);
+  REQUIRE(child.segment.next_segment() != nullptr);
+  REQUIRE(parent.splice(std::move(child)));
+  REQUIRE(parent.sections.size() == 1);
+  auto bottom = parent.sections[0].bottom;
+  REQUIRE(!parent.freeze());
+  REQUIRE(!parent.frozen());
+  REQUIRE(parent.sections[0].bottom == bottom);
+  REQUIRE(parent.backprop(parent.activations - 1)[0] == 1);
+}
+
+using wide_allocator = aligned_allocator<std::byte, 64>;
+
+template <class B>
+using wide_record = static_record<1, B, double, double*, wide_allocator>;
+
+struct wide_var : wide_record<wide_var> {
+  inline void prop(act_t, size_t) const noexcept {}
+};
+
+// scales by the sum of a cache line of weights
+struct wide_scale : wide_record<wide_scale> {
+  size_t a;
+  alignas(64) double w[8];
+  wide_scale(size_t a, double k) noexcept : a(a) {
+    for (auto & x : w) x = k / 8;
+  }
+  inline void prop(act_t act, size_t i) const noexcept {
+    double k = 0;
+    for (auto x : w) k += x;
+    act[a] += act[i] * k;
+  }
+};
+
+TEST_CASE("wide record alignment","[tapes]") {
+  STATIC_REQUIRE(abstract_record<double>::alignment == record_alignment);
+#ifdef BAD_HAS_MMAP
+  STATIC_REQUIRE(abstract_record<double, double*, huge_page_allocator<>>::alignment == record_alignment); // pages, not records
+#endif
+  STATIC_REQUIRE(abstract_record<double, double*, wide_allocator>::alignment == 64);
+  STATIC_REQUIRE(alignof(wide_var) == 64);
+  tape<double, double*, wide_allocator> t;
+  t.push<wide_var>();
+  for (size_t i=0;i<5000;++i) t.push<wide_scale>(i, 1.);
+  REQUIRE(t.segment.next_segment() != nullptr);
+  size_t misaligned = 0;
+  for (auto & r : t) misaligned += !is_aligned(&r, 64);
+  REQUIRE(misaligned == 0);
+  REQUIRE(t.backprop(5000)[0] == 1);
+}
+
+#ifdef BAD_HAS_MMAP
+template <class B>
+using huge_record = static_record<1, B, double, double*, huge_page_allocator<>>;
+
+struct huge_var : huge_record<huge_var> {
+  inline void prop(act_t, size_t) const noexcept {}
+};
+
+struct huge_scale : huge_record<huge_scale> {
+  size_t a;
+  double k;
+  std::array<double,2000> padding;
+  huge_scale(size_t a, double k) noexcept : a(a), k(k) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * k;
+  }
+};
+
+TEST_CASE("tapes on huge pages","[tapes]") {
+  using huge_tape = tape<double, double*, huge_page_allocator<>>;
+  REQUIRE(tapes::detail::segment<double, double*, huge_page_allocator<>>::minimum_size == huge_page_size);
+  huge_tape t;
+  t.push<huge_var>();
+  for (size_t i=0;i<300;++i) t.push<huge_scale>(i, i < 20 ? 2. : 1.);
+  REQUIRE(is_aligned(t.segment.memory, huge_page_size));
+  REQUIRE(t.segment.size % huge_page_size == 0);
+  auto g = t.backprop(300);
+  REQUIRE(g[0] == 1048576);
+}
+#endif
+
+#ifdef BAD_HAS_MMAP
+struct spill_test {};
+using spilling = spill_allocator<std::byte, spill_test>;
+
+template <class B>
+using spill_record = static_record<1, B, double, double*, spilling>;
+
+struct spill_var : spill_record<spill_var> {
+  inline void prop(act_t, size_t) const noexcept {}
+};
+
+struct spill_scale : spill_record<spill_scale> {
+  size_t a;
+  double k;
+  std::array<double,2000> padding;
+  spill_scale(size_t a, double k) noexcept : a(a), k(k) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * k;
+  }
+};
+
+TEST_CASE("tapes spill to disk","[tapes]") {
+  auto & arena = spilling::arena();
+  REQUIRE(&spill_allocator<double, spill_test>::arena() == &arena); // rebinding keeps the arena
+  REQUIRE(&spill_allocator<std::byte>::arena() != &arena);
+  arena.set_budget(spilling::segment_size * 4);
+  auto & pool = segment_pool<spilling>::local();
+  size_t high_water = pool.high_water_bytes;
+  pool.high_water_bytes = 0; // cached slabs count against the budget, and would crowd out the tape
+  segment_growth fixed { 0, 1 }; // so no segment outgrows the budget
+  {
+    tape<double, double*, spilling> t(fixed);
+    t.push<spill_var>();
+    for (size_t i=0;i<4000;++i) t.push<spill_scale>(i, i % 1000 == 0 ? 2. : 1.); // ~64MB over 1MB segments
+    REQUIRE(arena.evictions > 0);
+    REQUIRE(arena.resident >= t.segment.size); // the open segment counts too
+    REQUIRE(arena.resident <= arena.budget);
+    auto g = t.backprop(4000);
+    REQUIRE(g[0] == 16);
+    REQUIRE(g[1000] == 8);
+    REQUIRE(arena.resident <= arena.budget); // what the sweep read back in was dropped again
+    REQUIRE(t.backprop(4000)[0] == 16); // and reads back in fine
+  }
+  {
+    tape<double, double*, spilling> t(fixed); // well within the budget
+    t.push<spill_var>();
+    for (size_t i=0;i<100;++i) t.push<spill_scale>(i, 2.);
+    REQUIRE(t.segment.next_segment() != nullptr);
+    auto evictions = arena.evictions;
+    REQUIRE(t.backprop(100)[0] == std::ldexp(1., 100));
+    REQUIRE(t.backprop(100)[0] == std::ldexp(1., 100));
+    REQUIRE(arena.evictions == evictions); // so repeated sweeps never touch the disk
+  }
+  pool.high_water_bytes = high_water;
+  REQUIRE(arena.extents.empty());
+  REQUIRE(arena.resident == 0);
+}
+#endif
+
+// x_k = sin(x_{k-1}) elementwise, saved for the backward pass but allowed to be dropped
+struct wave : remat<double, wave> {
+  wave * input;
+  wave(remat_runtime & rt, size_t n, wave * input) noexcept : remat(rt, n), input(input) {}
+  void compute(double * out) const noexcept {
+    if (input == nullptr) {
+      for (size_t j=0;j<n;++j) out[j] = 1 + double(j) / double(n);
+    } else {
+      double const * x = input->get();
+      for (size_t j=0;j<n;++j) out[j] = std::sin(x[j]);
+    }
+  }
+};
+
+// s_k = s_{k-1} * mean(x_k)
+struct damp : static_record<1, damp, double> {
+  wave * x;
+  damp(wave * x) noexcept : x(x) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    double const * v = x->get();
+    double m = 0;
+    for (size_t j=0;j<x->n;++j) m += v[j];
+    act[i-1] += act[i] * m / double(x->n);
+  }
+};
+
+TEST_CASE("rematerialization","[tapes]") {
+  constexpr size_t n = 256, steps = 64;
+  remat_runtime rt(8 * n * sizeof(double));
+  std::vector<std::unique_ptr<wave>> waves;
+  tape<double> t;
+  t.push<var>();
+  double expected = 1;
+  wave * prev = nullptr;
+  for (size_t k=0;k<steps;++k) {
+    waves.push_back(std::make_unique<wave>(rt, n, prev));
+    prev = waves.back().get();
+    double const * v = prev->get();
+    double m = 0;
+    for (size_t j=0;j<n;++j) m += v[j];
+    expected *= m / double(n);
+    t.push<damp>(prev);
+  }
+  REQUIRE(rt.resident <= rt.budget);
+  REQUIRE(rt.evictions > 0);
+  auto g = t.backprop(steps);
+  REQUIRE(g[0] == Approx(expected));
+  REQUIRE(rt.recomputes > 0);
+  REQUIRE(rt.resident <= rt.budget);
+  t.clear();
+  REQUIRE(waves[6]->parents == std::vector<rematerializable *>{waves[5].get()});
+  REQUIRE(waves[4]->children == std::vector<rematerializable *>{waves[5].get()});
+  waves[5].reset(); // unhooks itself from both neighbours
+  REQUIRE(waves[6]->parents.empty());
+  REQUIRE(waves[4]->children.empty());
+  waves.clear();
+  REQUIRE(rt.values.empty());
+  REQUIRE(rt.resident == 0);
+  REQUIRE(rt.oldest == nullptr);
+  REQUIRE(rt.newest == nullptr);
+}
+
+// activation i = ka * a + kb * b
+struct lin : static_record<1, lin, double> {
+  size_t a, b;
+  double ka, kb;
+  lin(size_t a, double ka, size_t b, double kb) noexcept : a(a), b(b), ka(ka), kb(kb) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * ka;
+    act[b] += act[i] * kb;
+  }
+};
+
+// activation i = sin(a)
+struct sine : static_record<1, sine, double> {
+  size_t a;
+  double va;
+  sine(size_t a, double va) noexcept : a(a), va(va) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * std::cos(va);
+  }
+};
+
+// a pendulum, one explicit euler step at a time
+struct pendulum {
+  using state = std::array<double,2>;
+  static constexpr double h = 0.01;
+  size_t * advances;
+  size_t * records;
+
+  void advance(state & s) const noexcept {
+    ++*advances;
+    s = { s[0] + h * s[1], s[1] - h * std::sin(s[0]) };
+  }
+
+  static void step(tape<double> & t, state const & s, size_t const * in, size_t * out) noexcept {
+    size_t x = t.activations;
+    t.push<lin>(in[0], 1., in[1], h);
+    size_t sx = t.activations;
+    t.push<sine>(in[0], s[0]);
+    out[1] = t.activations;
+    t.push<lin>(in[1], 1., sx, -h);
+    out[0] = x;
+  }
+
+  void record(tape<double> & t, state const & s, size_t * out) const noexcept {
+    ++*records;
+    size_t in[2] = { 0, 1 };
+    step(t, s, in, out);
+  }
+};
+
+TEST_CASE("checkpointed loops","[tapes]") {
+  constexpr size_t n = 200;
+  // record every step for reference
+  tape<double> full;
+  full.push<var>();
+  full.push<var>();
+  pendulum::state s { 1., 0. };
+  size_t in[2] = { 0, 1 }, out[2];
+  size_t dummy = 0;
+  for (size_t k=0;k<n;++k) {
+    pendulum::step(full, s, in, out);
+    pendulum { &dummy, &dummy }.advance(s);
+    in[0] = out[0];
+    in[1] = out[1];
+  }
+  auto expected = full.backprop(in[0]);
+
+  for (size_t snapshots : { size_t(0), size_t(1), size_t(3) }) {
+    size_t advances = 0, records = 0;
+    tape<double> t;
+    t.push<var>();
+    t.push<var>();
+    pendulum::state c { 1., 0. };
+    size_t first = checkpointed_loop(t, c, n, {0, 1}, pendulum { &advances, &records }, snapshots);
+    REQUIRE(c == s);
+    REQUIRE(t.activations == 4);
+    advances = 0;
+    auto g = t.backprop(first);
+    REQUIRE(g[0] == Approx(expected[0]));
+    REQUIRE(g[1] == Approx(expected[1]));
+    REQUIRE(records == n); // each step is recorded exactly once, just before it is reversed
+    if (snapshots == 1) REQUIRE(advances <= n * n / 2);
+    if (snapshots == 0) REQUIRE(advances <= 5 * n); // 8 snapshots, so at most 4 repeats per step
+  }
+}
+
+// activation i = a * b, declaring what it reads so parallel sweeps can schedule around it
+struct pmul : static_record<1, pmul, double> {
+  size_t a, b;
+  double va, vb;
+  pmul(size_t a, double va, size_t b, double vb) noexcept : a(a), b(b), va(va), vb(vb) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * vb;
+    act[b] += act[i] * va;
+  }
+  bool inputs(size_t, std::vector<size_t> & out) const noexcept override {
+    out.push_back(a);
+    out.push_back(b);
+    return true;
+  }
+};
+
+struct pvar : static_record<1, pvar, double> {
+  inline void prop(act_t, size_t) const noexcept {}
+  bool inputs(size_t, std::vector<size_t> &) const noexcept override { return true; }
+};
+
+// records where the sweep asks for each segment ahead of reading it, and where it says it's done
+template <class T>
+struct watched_allocator : aligned_allocator<T, record_alignment> {
+  template <class U> struct rebind {
+    using other = watched_allocator<U>;
+  };
+  watched_allocator() = default;
+  template <class U> watched_allocator(watched_allocator<U> const &) noexcept {}
+  static inline std::vector<std::byte *> needed, done;
+  void will_need(std::byte * memory, size_t) const noexcept { needed.push_back(memory); }
+  void swept(std::byte * memory, size_t) const noexcept { done.push_back(memory); }
+};
+
+template <class B>
+using watched_record = static_record<1, B, double, double*, watched_allocator<std::byte>>;
+
+struct watched_var : watched_record<watched_var> {
+  inline void prop(act_t, size_t) const noexcept {}
+};
+
+struct watched_pmul : watched_record<watched_pmul> {
+  size_t a, b;
+  double va, vb;
+  watched_pmul(size_t a, double va, size_t b, double vb) noexcept : a(a), b(b), va(va), vb(vb) {}
+  inline void prop(act_t act, size_t i) const noexcept { // as pmul
+    act[a] += act[i] * vb;
+    act[b] += act[i] * va;
+  }
+};
+
+TEST_CASE("prefetching sweeps","[tapes]") {
+  using watched = watched_allocator<std::byte>;
+  tape<double, double*, watched> t;
+  tape<double> plain;
+  t.push<watched_var>();
+  plain.push<pvar>();
+  double vx = 1.01;
+  for (size_t i=0;i<5000;++i) { // rounding differs if any record is swept out of order
+    t.push<watched_pmul>(i, 0.99, i / 2, vx);
+    plain.push<pmul>(i, 0.99, i / 2, vx);
+    vx *= 0.999;
+  }
+  std::vector<std::byte *> chain; // newest first
+  for (auto s = &t.segment; s != nullptr; s = s->next_segment()) chain.push_back(s->memory);
+  REQUIRE(chain.size() > 2);
+  watched::needed.clear();
+  watched::done.clear();
+  auto g = t.backprop(5000);
+  auto expected = plain.backprop(5000);
+  REQUIRE(g.size() == expected.size());
+  REQUIRE(std::equal(g.begin(), g.end(), expected.begin())); // bit for bit
+  REQUIRE(watched::needed == std::vector<std::byte *>(chain.begin() + 1, chain.end())); // all but the first, in order
+  REQUIRE(watched::done == chain);
+}
+
+TEST_CASE("parallel sweeps","[tapes]") {
+  // a minibatch: every sample is a chain of products sharing the weight w, and the loss sums them
+  tape<double> t;
+  t.push<pvar>();
+  size_t w = 0;
+  double vw = 0.999;
+  size_t loss = no_index;
+  double vloss = 0;
+  for (size_t sample=0;sample<64;++sample) {
+    size_t x = t.activations;
+    t.push<pvar>();
+    double vx = 1 + double(sample) / 64;
+    for (size_t k=0;k<50;++k) {
+      size_t y = t.activations;
+      t.push<pmul>(x, vx, w, vw);
+      vx *= vw;
+      x = y;
+      if (k == 25 && sample % 16 == 0) t.push<mul>(x, vx, x, vx), vx *= vx, x = t.activations - 1; // undeclared, a barrier
+    }
+    if (loss == no_index) loss = x, vloss = vx;
+    else {
+      size_t l = t.activations;
+      t.push<lin>(loss, 1., x, 1.);
+      loss = l;
+      vloss += vx;
+    }
+  }
+  auto expected = t.backprop(loss);
+  sweep_executor ex(4);
+  REQUIRE(ex.size() == 4);
+  for (size_t grain : { size_t(1), size_t(7), size_t(256) }) {
+    parallel_sweep<double> plan(t, grain);
+    REQUIRE(plan.records.size() == 1 + 64 * 51 + 63 + 4);
+    adjoints<double> g;
+    for (int iteration=0;iteration<3;++iteration) {
+      REQUIRE(plan.backprop(ex, g, loss));
+      REQUIRE(std::equal(g.begin(), g.end(), expected.begin())); // bit for bit
+    }
+  }
+
+  tape<double> parent;
+  parent.push<var>();
+  auto child = parent.fork();
+  parent.push<var>(); // recorded after the fork, so the child becomes a section
+  child.push<scale>(0, 2.);
+  REQUIRE(parent.splice(std::move(child)));
+  REQUIRE(parent.sections.size() == 1);
+  parallel_sweep<double> refused(parent);
+  REQUIRE(!refused.schedulable);
+  adjoints<double> g;
+  REQUIRE(!refused.backprop(ex, g, 2));
+  REQUIRE(g.size() == 0);
+}
+
+// record x * w^k for a fresh input x onto whichever tape this thread is recording to, returning its activation
+static size_t power_chain(size_t w, double vw, double vx, size_t k, double & result) {
+  auto & t = *tape<double>::current();
+  size_t x = t.activations;
+  t.push<pvar>();
+  for (size_t j=0;j<k;++j) {
+    size_t y = t.activations;
+    t.push<scale>(x, vw); // w is held fixed here, so only x gets a gradient
+    t.push<pmul>(y, vx * vw, w, vx); // y * w, so w does
+    vx *= vw * vw;
+    x = y + 1;
+  }
+  result = vx;
+  return x;
+}
+
+TEST_CASE("pipelined sweeps","[tapes]") {
+  std::vector<std::future<adjoints<double>>> pending;
+  std::vector<tape<double> const *> used;
+  {
+    sweep_pipeline<double> pipe;
+    REQUIRE(pipe.depth() == 2);
+    for (size_t n = 0; n < 8; ++n) {
+      auto & t = pipe.acquire();
+      REQUIRE(t.activations == 0);
+      used.push_back(&t);
+      t.push<var>();
+      for (size_t i = 0; i <= n; ++i) t.push<scale>(i, 2.); // enough to span segments
+      pending.push_back(pipe.submit(t, n + 1));
+    }
+    REQUIRE(pending.front().get()[0] == 2);
+  } // the rest are finished by the time the pipeline is gone
+  for (size_t n = 1; n < 8; ++n) {
+    REQUIRE(pending[n].wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    REQUIRE(pending[n].get()[0] == double(size_t(2) << n));
+  }
+  std::sort(used.begin(), used.end());
+  REQUIRE(std::unique(used.begin(), used.end()) - used.begin() <= 2); // one, if each sweep beat the next acquire
+}
+
+TEST_CASE("forked tapes splice","[tapes]") {
+  constexpr size_t threads = 4;
+  double vw = 0.99;
+  size_t lengths[threads] = { 5, 40, 1, 17 };
+
+  // reference: everything on one tape
+  tape<double> serial;
+  serial.push<pvar>();
+  size_t serial_outs[threads];
+  {
+    recording<double> r(serial);
+    double v;
+    for (size_t k=0;k<threads;++k) serial_outs[k] = power_chain(0, vw, 1. + k, lengths[k], v);
+  }
+  size_t loss = serial_outs[0];
+  for (size_t k=1;k<threads;++k) {
+    size_t l = serial.activations;
+    serial.push<lin>(loss, 1., serial_outs[k], 1.);
+    loss = l;
+  }
+  auto expected = serial.backprop(loss);
+
+  tape<double> parent;
+  parent.push<pvar>();
+  std::vector<tape<double>> children;
+  for (size_t k=0;k<threads;++k) children.push_back(parent.fork());
+  parent.push<pvar>(); // recorded after the fork, so every child has to be renumbered
+  size_t outs[threads];
+  bool fresh[threads]; // catch's assertions aren't thread safe, so check these after joining
+  std::vector<std::thread> workers;
+  for (size_t k=0;k<threads;++k) workers.emplace_back([&, k] {
+    fresh[k] = tape<double>::current() == nullptr;
+    recording<double> r(children[k]);
+    double v;
+    outs[k] = power_chain(0, vw, 1. + k, lengths[k], v);
+  });
+  for (auto & w : workers) w.join();
+  REQUIRE(std::all_of(fresh, fresh + threads, [](bool b) { return b; }));
+  for (size_t k=0;k<threads;++k) {
+    size_t start = parent.activations;
+    REQUIRE(parent.splice(std::move(children[k])));
+    REQUIRE(children[k].activations == children[k].base);
+    outs[k] += start - 1; // children numbered their own activations from 1
+  }
+  REQUIRE(parent.sections.size() == threads);
+  loss = outs[0];
+  for (size_t k=1;k<threads;++k) {
+    size_t l = parent.activations;
+    parent.push<lin>(loss, 1., outs[k], 1.);
+    loss = l;
+  }
+  auto g = parent.backprop(loss);
+  REQUIRE(g[0] == Approx(expected[0]));
+  REQUIRE(g[1] == 0);
+  for (size_t k=0, a=1, b=2;k<threads;++k) {
+    REQUIRE(g[b] == Approx(expected[a])); // each child's input x
+    a += 1 + 2 * lengths[k];
+    b += 1 + 2 * lengths[k];
+  }
+
+  parent.rewind({ nullptr, nullptr, 0 });
+  REQUIRE(parent.sections.empty());
+}
+
+// activation i = ka * a + kb * b, fusable
+struct flin : static_record<1, flin, double> {
+  size_t a, b;
+  double ka, kb;
+  flin(size_t a, double ka, size_t b, double kb) noexcept : a(a), b(b), ka(ka), kb(kb) {}
+  auto fields() const noexcept { return std::make_tuple(a, b, ka, kb); }
+  static void lane(act_t act, size_t i, size_t a, size_t b, double ka, double kb) noexcept {
+    act[a] += act[i] * ka;
+    act[b] += act[i] * kb;
+  }
+  inline void prop(act_t act, size_t i) const noexcept { lane(act, i, a, b, ka, kb); }
+};
+
+// activation i = k * a, fusable, with a narrower payload
+struct fscale : static_record<1, fscale, double> {
+  uint32_t a;
+  float k;
+  fscale(uint32_t a, float k) noexcept : a(a), k(k) {}
+  auto fields() const noexcept { return std::make_tuple(a, k); }
+  static void lane(act_t act, size_t i, uint32_t a, float k) noexcept { act[a] += act[i] * k; }
+  inline void prop(act_t act, size_t i) const noexcept { lane(act, i, a, k); }
+};
+
+TEST_CASE("fusing runs of records","[tapes]") {
+  tape<double> t;
+  t.push<var>();
+  t.push<var>();
+  for (size_t run=0;run<50;++run) {
+    for (size_t j=0;j<1+run%7;++j) {
+      size_t i = t.activations;
+      t.push<flin>(i - 1, 0.5 + double(j) / 8, i - 2, 0.25);
+    }
+    size_t i = t.activations;
+    t.push<fscale>(uint32_t(i - 1), 0.75f);
+    if (run % 3 == 0) t.push<mul>(i, 1.5, i - 1, 2.); // not fusable, breaks up the runs
+  }
+  size_t out = t.activations - 1;
+  auto expected = t.backprop(out);
+  size_t records = 0;
+  for (auto it = t.begin(); it != t.end(); ++it) ++records;
+
+  size_t fused = fuse<flin, fscale>(t);
+  REQUIRE(fused > 0);
+  size_t after = 0;
+  for (auto it = t.begin(); it != t.end(); ++it) ++after;
+  REQUIRE(after < records);
+  auto g = t.backprop(out);
+  REQUIRE(std::equal(g.begin(), g.end(), expected.begin()));
+
+  // fusing is idempotent, and the tape carries on recording afterwards
+  REQUIRE(fuse<flin, fscale>(t) == 0);
+  size_t i = t.activations;
+  t.push<flin>(i - 1, 2., 0, 1.);
+  REQUIRE(t.backprop(i)[i - 1] == 2);
+}
+
+TEST_CASE("tape statistics","[tapes]") {
+  tape<double> t;
+  t.push<var>();
+  t.push<var>();
+  for (size_t i=0;i<10;++i) t.push<mul>(i, 1., i + 1, 2.);
+  for (size_t i=0;i<20;++i) t.push<scale>(t.activations - 1, 0.5);
+
+  auto s = stats(t);
+  REQUIRE(s.records.size() == 3);
+  REQUIRE(s.records[0].name.find("scale") != std::string::npos); // the most bytes, so listed first
+  REQUIRE(s.records[0].count == 20);
+  REQUIRE(s.records[0].bytes == 20 * tapes::detail::pad_to_alignment(sizeof(scale)));
+  size_t records = 0, activations = 0;
+  for (auto & r : s.records) records += r.count, activations += r.activations;
+  REQUIRE(records == 32);
+  REQUIRE(activations == t.activations);
+  REQUIRE(s.segments > 1);
+  REQUIRE(s.slab_bytes == t.bytes);
+  REQUIRE(s.record_bytes + s.boundary_bytes + s.free_bytes == s.slab_bytes);
+  REQUIRE(s.fragmentation() > 0);
+  REQUIRE(s.ticks == 0);
+
+  adjoints<double> g;
+  g.reset(t.activations);
+  g[t.activations - 1] = 1;
+  auto p = profile(t, g.data());
+  REQUIRE(g[0] != 0);
+  REQUIRE(p.ticks > 0);
+  uint64_t ticks = 0;
+  for (auto & r : p.records) ticks += r.ticks;
+  REQUIRE(ticks <= p.ticks);
+  std::ostringstream os;
+  os << p;
+  REQUIRE(os.str().find("mul") != std::string::npos);
+}
+
+TEST_CASE("tape traces","[tapes]") {
+  tape<double> quiet;
+  quiet.push<var>();
+  REQUIRE(trace::active() == nullptr);
+
+  trace tr;
+  tr.start();
+  REQUIRE(trace::active() == &tr);
+  tape<double> t;
+  t.push<var>();
+  for (size_t i=0;i<1000;++i) t.push<scale>(i, 1.);
+  REQUIRE(t.backprop(1000)[0] == 1);
+  REQUIRE(quiet.backprop(0)[0] == 1);
+  tr.stop();
+  REQUIRE(trace::active() == nullptr);
+  t.push<scale>(1000, 1.);
+
+  auto count = [&](std::string const & name) {
+    size_t n = 0;
+    for (auto & e : tr.events) n += name == e.name;
+    return n;
+  };
+  size_t segments = 0;
+  for (auto s = &t.segment; s != nullptr; s = s->next_segment()) ++segments;
+  REQUIRE(segments > 1);
+  REQUIRE(count("segment") == segments);
+  REQUIRE(count("link") == segments - 1);
+  REQUIRE(count("record") == segments); // quiet opened its segment before the trace started
+  REQUIRE(count("sweep") == 2);
+  REQUIRE(count("sweep segment") == segments + 1);
+  size_t recorded = 0;
+  for (auto & e : tr.events) if (e.name == std::string("record")) recorded += e.bytes;
+  REQUIRE(recorded >= 1000 * sizeof(scale));
+
+  std::ostringstream os;
+  tr.write(os);
+  auto json = os.str();
+  REQUIRE(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0);
+  REQUIRE(json.find("\"name\":\"sweep segment\",\"cat\":\"tape\",\"ph\":\"X\"") != std::string::npos);
+  REQUIRE(json.find("\"ph\":\"i\"") != std::string::npos);
+  REQUIRE(!tr.write("/nonexistent/trace.json"));
+
+  // traces come and go while another thread is reporting to them. stopping waits it out
+  std::atomic<bool> done { false };
+  double sink = 0;
+  std::thread sweeper([&] {
+    tape<double> u;
+    do {
+      u.push<var>();
+      for (size_t i=0;i<1000;++i) u.push<scale>(i, 1.);
+      sink += u.backprop(1000)[0];
+      u.clear();
+    } while (!done.load());
+  });
+  for (size_t k=0;k<200;++k) {
+    trace brief;
+    brief.start();
+    std::this_thread::yield();
+  }
+  done.store(true);
+  sweeper.join();
+  REQUIRE(trace::active() == nullptr);
+  REQUIRE(tapes::detail::trace_users.load() == 0);
+  REQUIRE(sink >= 1);
+}
+
+// replayable records for f(x,y) = k * sin(x * y) * x
+struct rvar : static_record<1, rvar, double> {
+  inline void prop(act_t, size_t) const noexcept {}
+  bool replay(double *, size_t) noexcept override { return true; }
+};
+
+struct rmul : static_record<1, rmul, double> {
+  size_t a, b;
+  double va, vb;
+  rmul(size_t a, double va, size_t b, double vb) noexcept : a(a), b(b), va(va), vb(vb) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * vb;
+    act[b] += act[i] * va;
+  }
+  bool replay(double * values, size_t i) noexcept override {
+    va = values[a];
+    vb = values[b];
+    values[i] = va * vb;
+    return true;
+  }
+};
+
+struct rsin : static_record<1, rsin, double> {
+  size_t a;
+  double cos_a;
+  rsin(size_t a, double x) noexcept : a(a), cos_a(std::cos(x)) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * cos_a;
+  }
+  bool replay(double * values, size_t i) noexcept override {
+    cos_a = std::cos(values[a]);
+    values[i] = std::sin(values[a]);
+    return true;
+  }
+};
+
+// padded, so a chain of these crosses segments
+struct rscale : static_record<1, rscale, double> {
+  size_t a;
+  double k;
+  std::array<double,2000> padding;
+  rscale(size_t a, double k) noexcept : a(a), k(k) {}
+  inline void prop(act_t act, size_t i) const noexcept {
+    act[a] += act[i] * k;
+  }
+  bool replay(double * values, size_t i) noexcept override {
+    values[i] = values[a] * k;
+    return true;
+  }
+};
+
+TEST_CASE("replaying tapes","[tapes]") {
+  auto record = [](tape<double> & t, double x, double y) {
+    t.push<rvar>();
+    t.push<rvar>();
+    t.push<rmul>(0, x, 1, y);
+    t.push<rsin>(2, x * y);
+    t.push<rmul>(3, std::sin(x * y), 0, x);
+    for (size_t i=0;i<20;++i) t.push<rscale>(t.activations - 1, 1.25);
+  };
+  tape<double> t;
+  record(t, 0.5, 0.25);
+  replay_plan plan(t);
+  REQUIRE(plan.records.size() == 25);
+  REQUIRE(plan.starts[24] == 24);
+  std::vector<double> values(t.activations);
+  for (auto [x, y] : { std::pair(1.5, -0.5), std::pair(0.25, 2.0), std::pair(-3.0, 0.75) }) {
+    values[0] = x;
+    values[1] = y;
+    REQUIRE(plan(values.data()));
+    tape<double> fresh;
+    record(fresh, x, y);
+    REQUIRE(values[4] == std::sin(x * y) * x);
+    auto expected = fresh.backprop(24);
+    auto actual = t.backprop(24);
+    REQUIRE(std::equal(expected.begin(), expected.end(), actual.begin()));
+  }
+  t.push<scale>(24, 2.);
+  values.push_back(0);
+  REQUIRE_FALSE(replay_plan(t)(values.data())); // scale can't be replayed
+
+  tape<double> parent;
+  parent.push<rvar>();
+  auto child = parent.fork();
+  parent.push<rvar>(); // recorded after the fork, so the child becomes a section
+  child.push<rscale>(0, 2.);
+  REQUIRE(parent.splice(std::move(child)));
+  replay_plan refused(parent);
+  REQUIRE(!refused.replayable);
+  REQUIRE(refused.records.empty());
+  std::vector<double> spliced { 1., 2., 3. };
+  REQUIRE_FALSE(refused(spliced.data()));
+  REQUIRE(spliced[2] == 3.); // untouched
+}
+
+// records generic in their activation type, so they can carry one adjoint or several
+template <class Act>
+struct gvar : static_record<1, gvar<Act>, double, Act> {
+  inline void prop(Act, size_t) const noexcept {}
+  bool inputs(size_t, std::vector<size_t> &) const noexcept override { return true; }
+};
+
+template <class Act>
+struct gmul : static_record<1, gmul<Act>, double, Act> {
+  size_t a, b;
+  double va, vb;
+  gmul(size_t a, double va, size_t b, double vb) noexcept : a(a), b(b), va(va), vb(vb) {}
+  inline void prop(Act act, size_t i) const noexcept {
+    act[a] += act[i] * vb;
+    act[b] += act[i] * va;
+  }
+  bool inputs(size_t, std::vector<size_t> & out) const noexcept override {
+    out.push_back(a);
+    out.push_back(b);
+    return true;
+  }
+};
+
+template <class Act>
+void record_products(tape<double, Act> & t, std::vector<double> & v) {
+  // three inputs, then every pairwise product of what came before, twice over
+  for (size_t i=0;i<3;++i) {
+    t.template push<gvar<Act>>();
+    v.push_back(1.5 + double(i));
+  }
+  for (size_t round=0;round<2;++round) {
+    size_t n = v.size();
+    for (size_t a=0;a+1<n;a+=2) {
+      t.template push<gmul<Act>>(a, v[a], a+1, v[a+1]);
+      v.push_back(v[a] * v[a+1]);
+    }
+  }
+}
+
+TEST_CASE("vector mode jacobians","[tapes]") {
+  using L = lanes<double,4>;
+  STATIC_REQUIRE(alignof(L) == 32);
+  STATIC_REQUIRE(alignof(lanes<double,3>) == 8);
+  STATIC_REQUIRE(std::is_trivially_copyable_v<L>);
+  REQUIRE((L(2.) * 3. + L(1.))[3] == 7);
+
+  tape<double> scalar;
+  std::vector<double> v;
+  record_products(scalar, v);
+  tape<double, L*> wide;
+  std::vector<double> w;
+  record_products(wide, w);
+  REQUIRE(wide.activations == scalar.activations);
+
+  std::vector<size_t> inputs { 0, 1, 2 }, outputs;
+  for (size_t i=0;i<scalar.activations;++i) outputs.push_back(i);
+  auto J = jacobian(wide, outputs, inputs);
+  REQUIRE(J.size() == outputs.size() * inputs.size());
+  for (size_t r=0;r<outputs.size();++r) {
+    auto g = scalar.backprop(outputs[r]);
+    for (size_t j=0;j<inputs.size();++j) REQUIRE(J[r * inputs.size() + j] == g[inputs[j]]);
+  }
+  REQUIRE(J[3 * 3 + 0] == 2.5); // d(x0 x1)/dx0
+  REQUIRE(J[3 * 3 + 2] == 0);
+}
+
+TEST_CASE("sparse jacobians","[tapes]") {
+  // y[r] = x[r] * x[r+1] * x[r+2], a banded Jacobian over 40 inputs
+  static constexpr size_t n = 40;
+  tape<double> t;
+  std::vector<double> x;
+  std::vector<size_t> inputs, outputs;
+  for (size_t j=0;j<n;++j) {
+    inputs.push_back(t.activations);
+    t.push<pvar>();
+    x.push_back(1 + double(j) / 8);
+  }
+  for (size_t r=0;r+2<n;++r) {
+    size_t p = t.activations;
+    t.push<pmul>(inputs[r], x[r], inputs[r+1], x[r+1]);
+    outputs.push_back(t.activations);
+    t.push<pmul>(p, x[r] * x[r+1], inputs[r+2], x[r+2]);
+  }
+
+  sparsity_pattern p;
+  REQUIRE(detect_sparsity(t, outputs, inputs, p));
+  REQUIRE(p.rows == n - 2);
+  REQUIRE(p.nonzeros() == 3 * (n - 2));
+  REQUIRE(p.columns[p.first[5]] == 5);
+  REQUIRE(p.columns[p.first[5] + 2] == 7);
+
+  sparse_jacobian<double> J(t, outputs, inputs);
+  REQUIRE(J.colors == 3); // rows three apart never share an input
+  REQUIRE(J.sweeps() == 3);
+  std::vector<double> values;
+  adjoints<double> buffer;
+  REQUIRE(J(t, values, buffer));
+  std::vector<double> dense(p.rows * n), scattered(p.rows * n);
+  for (size_t r=0;r<p.rows;++r) {
+    auto g = t.backprop(outputs[r]);
+    for (size_t j=0;j<n;++j) dense[r * n + j] = g[inputs[j]];
+    for (size_t e=p.first[r];e<p.first[r+1];++e) scattered[r * n + p.columns[e]] = values[e];
+  }
+  REQUIRE(dense == scattered);
+
+  t.push<mul>(0, x[0], 1, x[1]); // doesn't declare its inputs
+  REQUIRE_FALSE(detect_sparsity(t, outputs, inputs, p));
+
+  tape<double> parent;
+  parent.push<pvar>();
+  auto child = parent.fork();
+  parent.push<pvar>(); // recorded after the fork, so the child becomes a section
+  child.push<pmul>(0, 1., 0, 1.);
+  REQUIRE(parent.splice(std::move(child)));
+  REQUIRE_FALSE(detect_sparsity(parent, { 2 }, { 0, 1 }, p));
+  sparse_jacobian<double> refused(parent, { 2 }, { 0, 1 }); // no assert to lean on, as under NDEBUG
+  REQUIRE(!refused.detected);
+  REQUIRE(refused.sweeps() == 0);
+  std::vector<double> untouched { 42. };
+  REQUIRE(!refused(parent, untouched, buffer));
+  REQUIRE(untouched == std::vector<double>{ 42. });
+
+  // four colors per sweep
+  tape<double, lanes<double,4>*> wide;
+  std::vector<double> v;
+  record_products(wide, v);
+  std::vector<size_t> all(wide.activations);
+  std::iota(all.begin(), all.end(), 0);
+  sparse_jacobian<double, lanes<double,4>*> K(wide, all, { 0, 1, 2 });
+  REQUIRE(K.sweeps() == (K.colors + 3) / 4);
+  adjoints<lanes<double,4>> wide_buffer;
+  REQUIRE(K(wide, values, wide_buffer));
+  auto full = jacobian(wide, all, { 0, 1, 2 });
+  std::vector<double> wide_scattered(full.size());
+  for (size_t r=0;r<all.size();++r)
+    for (size_t e=K.pattern.first[r];e<K.pattern.first[r+1];++e) wide_scattered[r * 3 + K.pattern.columns[e]] = values[e];
+  REQUIRE(full == wide_scattered);
+}
+
+// records generic in their scalar, so they can save dual numbers
+template <class T>
+struct smul : static_record<1, smul<T>, T> {
+  size_t a, b;
+  T va, vb;
+  smul(size_t a, T va, size_t b, T vb) noexcept : a(a), b(b), va(va), vb(vb) {}
+  inline void prop(T * act, size_t i) const noexcept {
+    act[a] += act[i] * vb;
+    act[b] += act[i] * va;
+  }
+};
+
+template <class T>
+struct sadd : static_record<1, sadd<T>, T> {
+  size_t a, b;
+  sadd(size_t a, size_t b) noexcept : a(a), b(b) {}
+  inline void prop(T * act, size_t i) const noexcept {
+    act[a] += act[i];
+    act[b] += act[i];
+  }
+};
+
+TEST_CASE("hessian vector products","[tapes]") {
+  STATIC_REQUIRE(std::is_trivially_destructible_v<mixed<double>>);
+  // f(x,y,z) = x y z + x^2
+  auto f = [](auto & t, auto const & xs) {
+    using T = typename std::decay_t<decltype(xs)>::value_type;
+    size_t xy = t.activations;
+    t.template push<smul<T>>(0, xs[0], 1, xs[1]);
+    T vxy = xs[0] * xs[1];
+    size_t xyz = t.activations;
+    t.template push<smul<T>>(xy, vxy, 2, xs[2]);
+    size_t xx = t.activations;
+    t.template push<smul<T>>(0, xs[0], 0, xs[0]);
+    size_t result = t.activations;
+    t.template push<sadd<T>>(xyz, xx);
+    return result;
+  };
+  std::vector<double> x { 2, 3, 5 }, g, hv;
+  hvp(f, x, { 1, 0, 0 }, g, hv);
+  REQUIRE(g == std::vector<double> { 19, 10, 6 }); // yz + 2x, xz, xy
+  REQUIRE(hv == std::vector<double> { 2, 5, 3 }); // the first column of the Hessian: 2, z, y
+  REQUIRE(hvp(f, x, { 0, 1, -1 }) == std::vector<double> { 5 - 3, -2, 2 }); // z - y, -x, x
+
+  adjoints<mixed<double>> buffer(4);
+  buffer.reset(2); // assigns over live slots
+  REQUIRE(buffer.size() == 2);
+  REQUIRE(buffer.constructed == 4);
+  buffer.reset(8); // constructs the new ones in place
+  REQUIRE(buffer.constructed == 8);
+  REQUIRE(buffer[7].primal() == 0);
+}
+
+TEST_CASE("sparse hessians","[tapes]") {
+  // f(x) = sum x[j]^2 x[j+1] + sum x[0] x[j], a tridiagonal Hessian with an arrowhead
+  static constexpr size_t n = 30;
+  auto f = [](auto & t, auto const & xs) {
+    using T = typename std::decay_t<decltype(xs)>::value_type;
+    size_t sum = no_index;
+    T vsum;
+    auto add = [&](size_t a, T va) {
+      if (sum == no_index) sum = a, vsum = va;
+      else {
+        size_t s = t.activations;
+        t.template push<sadd<T>>(sum, a);
+        sum = s;
+        vsum += va;
+      }
+    };
+    for (size_t j=0;j+1<n;++j) {
+      size_t sq = t.activations;
+      t.template push<smul<T>>(j, xs[j], j, xs[j]);
+      T vsq = xs[j] * xs[j];
+      add(t.activations, vsq * xs[j+1]);
+      t.template push<smul<T>>(sq, vsq, j + 1, xs[j+1]);
+    }
+    for (size_t j=1;j<n;++j) {
+      add(t.activations, xs[0] * xs[j]);
+      t.template push<smul<T>>(0, xs[0], j, xs[j]);
+    }
+    return sum;
+  };
+
+  // the elements, recorded with records that declare their inputs
+  tape<double> t;
+  std::vector<size_t> inputs, elements;
+  for (size_t j=0;j<n;++j) inputs.push_back(t.activations), t.push<pvar>();
+  for (size_t j=0;j+1<n;++j) {
+    size_t sq = t.activations;
+    t.push<pmul>(j, 1., j, 1.);
+    elements.push_back(t.activations);
+    t.push<pmul>(sq, 1., j + 1, 1.);
+  }
+  for (size_t j=1;j<n;++j) elements.push_back(t.activations), t.push<pmul>(0, 1., j, 1.);
+  sparsity_pattern je, p;
+  REQUIRE(detect_sparsity(t, elements, inputs, je));
+  hessian_sparsity(je, p);
+  REQUIRE(p.rows == n);
+  REQUIRE(p.nonzeros() == n + 2 * (n - 1) + 2 * (n - 2)); // diagonal, row and column 0, off diagonals
+
+  sparse_hessian<double> H(p);
+  REQUIRE(H.pattern.nonzeros() == p.nonzeros());
+  REQUIRE(H.colors <= 4);
+  std::vector<double> x(n), values, g;
+  for (size_t j=0;j<n;++j) x[j] = 1 + double(j) / 16;
+  H(f, x, values, g);
+  size_t wrong = 0, stray = 0;
+  for (size_t j=0;j<n;++j) {
+    std::vector<double> unit(n, 0.), gj, column;
+    unit[j] = 1;
+    hvp(f, x, unit, gj, column);
+    REQUIRE(gj == g);
+    for (size_t i=0;i<n;++i) {
+      auto lo = H.pattern.columns.begin() + std::ptrdiff_t(H.pattern.first[i]);
+      auto hi = H.pattern.columns.begin() + std::ptrdiff_t(H.pattern.first[i + 1]);
+      auto at = std::lower_bound(lo, hi, uint32_t(j));
+      if (at != hi && *at == j) wrong += values[size_t(at - H.pattern.columns.begin())] != Approx(column[i]);
+      else stray += column[i] != 0;
+    }
+  }
+  REQUIRE(wrong == 0);
+  REQUIRE(stray == 0); // the detected pattern covers the Hessian
+
+  // an arrowhead alone takes two colors, where a distance-2 coloring needs one per input
+  sparsity_pattern arrow;
+  arrow.rows = arrow.cols = n;
+  arrow.first.assign(1, 0);
+  for (size_t j=0;j<n;++j) {
+    if (j == 0) for (size_t k=1;k<n;++k) arrow.columns.push_back(uint32_t(k));
+    else arrow.columns.push_back(0);
+    arrow.first.push_back(arrow.columns.size());
+  }
+  std::vector<uint32_t> color;
+  REQUIRE(star_color(arrow, color) == 2);
+}
+
+TEST_CASE("segments grow geometrically","[tapes]") {
+  using segment_t = tapes::detail::segment<double>;
+  tape<double> t;
+  t.push<var>();
+  REQUIRE(t.segment.size == segment_t::minimum_size);
+  for (size_t i=0;i<100;++i) t.push<scale>(i, 1.);
+  REQUIRE(t.segment.size >= 16 * segment_t::minimum_size);
+  REQUIRE(t.bytes >= 100 * sizeof(scale));
+  REQUIRE(t.bytes < 4 * 100 * sizeof(scale));
+  REQUIRE(t.backprop(100)[0] == 1);
+
+  tape<double> fixed(segment_growth { 0, 1 });
+  fixed.push<var>();
+  for (size_t i=0;i<100;++i) fixed.push<scale>(i, 1.);
+  REQUIRE(fixed.segment.size <= 2 * segment_t::minimum_size); // the pool may hand us a slightly bigger slab
+
+  segment_growth capped { 0, 2, segment_t::minimum_size * 4 };
+  REQUIRE(capped(segment_t::minimum_size * 4, 64, segment_t::minimum_size) == segment_t::minimum_size * 4);
+  REQUIRE(capped(segment_t::minimum_size * 4, segment_t::minimum_size * 9, segment_t::minimum_size) == segment_t::minimum_size * 9);
+}
+
+TEST_CASE("tape budgets","[tapes]") {
+  using segment_t = tapes::detail::segment<double>;
+  size_t before = resident_tape_bytes();
+  struct log {
+    size_t soft = 0, hard = 0, largest = 0;
+  } seen;
+  {
+    tape<double> t(tape_budget { 4 * segment_t::minimum_size, 16 * segment_t::minimum_size,
+      [](void * context, budget_level level, size_t bytes) noexcept {
+        auto & l = *static_cast<log *>(context);
+        ++(level == budget_level::soft ? l.soft : l.hard);
+        l.largest = std::max(l.largest, bytes);
+        return true; // let it grow anyway
+      }, &seen });
+    t.push<var>();
+    for (size_t i=0;i<100;++i) t.push<scale>(i, 1.);
+    REQUIRE(t.bytes > 16 * segment_t::minimum_size);
+    REQUIRE(resident_tape_bytes() - before == t.bytes);
+    REQUIRE(seen.soft == 1);
+    REQUIRE(seen.hard >= 1);
+    REQUIRE(seen.largest <= t.bytes); // the pool may hand out slightly bigger slabs than asked for
+    REQUIRE(t.backprop(100)[0] == 1);
+
+    auto child = t.fork();
+    REQUIRE(child.budget.hard == t.budget.hard);
+    t.clear();
+    REQUIRE(seen.soft == 2); // clear kept a slab past soft
+    t.push<var>();
+    for (size_t i=0;i<100;++i) t.push<scale>(i, 1.);
+    REQUIRE(seen.soft == 2); // big enough for everything
+  }
+  REQUIRE(resident_tape_bytes() == before);
+
+  // no handler, so growing past hard is refused
+  tape<double> t(tape_budget { tape_budget::unlimited, 4 * segment_t::minimum_size });
+  t.push<var>();
+  size_t pushed = 0;
+  while (t.try_push<scale>(pushed, 1.) != nullptr) ++pushed;
+  REQUIRE(pushed > 0);
+  REQUIRE(t.bytes <= t.budget.hard);
+  REQUIRE(t.activations == pushed + 1);
+  REQUIRE(t.backprop(pushed)[0] == 1); // still whole
+
+  // nor may clear keep a slab sized for a peak past it
+  auto newest = t.segment.memory;
+  REQUIRE(t.segment.next_segment() != nullptr);
+  t.budget.hard = t.segment.size;
+  t.clear();
+  REQUIRE(t.segment.memory == newest);
+  REQUIRE(t.bytes == t.segment.size);
+
+  // and splicing counts the child's bytes against ours
+  t.budget.hard = tape_budget::unlimited;
+  t.push<var>();
+  auto child = t.fork();
+  child.push<scale>(0, 2.);
+  t.budget.hard = t.bytes;
+  REQUIRE(!t.splice(std::move(child)));
+  REQUIRE(child.activations == 2);
+  t.budget.hard += child.bytes;
+  REQUIRE(t.splice(std::move(child)));
+  REQUIRE(t.backprop(1)[0] == 2);
+}
+
+TEST_CASE("clear sizes from the peak","[tapes]") {
+  tape<double> t;
+  t.push<var>();
+  for (size_t i=0;i<100;++i) t.push<scale>(i, 1.);
+  t.clear();
+  REQUIRE(t.bytes == t.segment.size);
+  auto slab = t.segment.memory;
+  t.push<var>();
+  for (size_t i=0;i<100;++i) t.push<scale>(i, 1.);
+  REQUIRE(t.segment.memory == slab); // everything fit in one segment this time
+  REQUIRE(t.bytes == t.segment.size);
+  REQUIRE(t.backprop(100)[0] == 1);
+}